@@ -0,0 +1,85 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+
+/**
+ * \file 	arena.h
+ * \author 	Carlos Nihelton <carlosnsoliveira@gmail.com>
+ * \details	It contains the slab allocator holding the snapshots of queued log entries.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <atomic>
+#include <cstddef>
+
+namespace sqlogger {
+/**
+ * \class 	sqlogger::Arena
+ * \brief 	A per-thread slab allocator for the payloads of queued log entries.
+ * \details 	Each producer thread carves its snapshots out of its own slab with a bump pointer, so logging takes
+ * 		no lock and calls no malloc once slabs are warm. The writer thread returns blocks in bulk after committing them;
+ * 		a slab goes back to a shared pool when its last block is returned and its owner has moved to another slab.
+ * 		Blocks larger than a quarter of a slab fall back to the heap.
+ */
+  class Arena
+  {
+  public:
+    ///A block handed out by allocate(). It must be returned exactly once through release().
+    struct Block {
+      char* data;
+      void* slab;	///< nullptr for heap fallbacks.
+    };
+    
+    ///Process wide counters.
+    struct Stats {
+      std::size_t inUse;		///< Bytes of slabs holding live blocks or being filled.
+      std::size_t highWater;	///< Highest inUse so far.
+      std::size_t fallbacks;	///< Blocks allocated from the heap because they did not fit a slab.
+    };
+    
+    static const std::size_t slabSize = 64*1024;
+    
+    ///Allocates size bytes from the calling thread's arena.
+    static Block allocate(std::size_t size);
+    ///Returns n blocks, possibly from several threads' arenas. Consecutive blocks of the same slab cost one atomic operation.
+    static void release(const Block* blocks, std::size_t n) noexcept;
+    static Stats getStats() noexcept;
+    
+    Arena() : current(nullptr) {};
+    Arena(Arena const&)=delete;
+    Arena& operator=(Arena const&)=delete;
+    ~Arena();
+    
+  private:
+    struct Slab;
+    ///Drops count references to a slab, recycling it when none is left.
+    static void unref(Slab* slab, std::size_t count) noexcept;
+    
+    Slab* current;
+  };
+  
+}
+
+#endif
@@ -0,0 +1,117 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+/**
+ * \file 	crashring.h
+ * \author 	Carlos Nihelton <carlosnsoliveira@gmail.com>
+ * \details	It contains the memory-mapped ring that keeps queued records across a crash.
+ */
+
+#ifndef CRASHRING_H
+#define CRASHRING_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace sqlogger {
+/**
+ * \class 	sqlogger::CrashRing
+ * \brief 	A file of fixed-size slots, mapped in memory, holding a copy of the last records queued.
+ * \details 	Each queued record is copied into the next slot, overwriting the oldest one, and released once committed.
+ * 		The mapping is shared with the file, so when the process dies, the records it kept but never released are
+ * 		still in the file and are read back by the next process. The tables of the records are described in an area
+ * 		at the start of the file. A slot is flagged busy while it is written, so a record torn by the crash is ignored.
+ * 		Put the file on tmpfs to survive process crashes only, or on disk to survive a power loss too, at the price of
+ * 		the page cache writing it back.
+ */
+  class CrashRing
+  {
+  public:
+    ///A table as described with describe().
+    struct Table {
+      std::uint32_t id;
+      std::string name;
+      std::string schema;
+      std::string query;
+    };
+    ///A record kept by a former process and never released.
+    struct Kept {
+      std::uint32_t table;
+      const char* data;
+      std::size_t size;
+    };
+    
+    /**
+     * Maps the ring file, creating it if it does not exist or is not a ring. An existing ring keeps its geometry
+     * and contents until reset().
+     * \param slots		Number of records kept at most.
+     * \param slotSize	Bytes per slot, including a 16 byte header. Larger records are not kept.
+     * \throw std::runtime_error if the file cannot be created or mapped.
+     */
+    CrashRing(const std::string& file, std::size_t slots, std::size_t slotSize);
+    CrashRing(CrashRing const&)=delete;
+    CrashRing& operator=(CrashRing const&)=delete;
+    ~CrashRing();
+    
+    ///Describes a table, so that its records can be written back. \return false if the table area is full.
+    bool describe(std::uint32_t id, const std::string& name, const std::string& schema, const std::string& query) noexcept;
+    /**
+     * Copies a record into the next slot. Thread safe.
+     * \return Its ticket for release(), 0 if it is not kept: too large, or its slot is being written by another thread.
+     */
+    std::uint64_t keep(std::uint32_t table, const char* data, std::size_t size) noexcept;
+    ///Flags a kept record as committed. Does nothing if its slot was reused since.
+    void release(std::uint64_t ticket) noexcept;
+    
+    ///\name 	Recovery, before any record is kept.
+    ///\{
+    ///\return The tables described in the file.
+    std::vector<Table> tables() const;
+    ///\return The records kept and never released, oldest first. They refer to the mapping, valid until reset().
+    std::vector<Kept> pending() const;
+    ///Empties the ring, giving it the geometry asked for. \throw std::runtime_error if it cannot be recreated.
+    void reset();
+    ///\}
+    
+  private:
+    void create();
+    char* slot(std::uint64_t ticket) const noexcept {return base + first + (ticket % slots)*slotSize;};
+    
+    const std::string file;
+    const std::size_t wantedSlots;
+    const std::size_t wantedSlotSize;
+    std::size_t slots;
+    std::size_t slotSize;
+    std::size_t length;
+    char* base;
+    std::atomic<std::uint64_t> sequence;
+    ///Offset of the first slot, past the header and the table area.
+    static const std::size_t first;
+  };
+  
+}
+
+#endif
@@ -0,0 +1,92 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+
+/**
+ * \file 	metrics.h
+ * \author 	Carlos Nihelton <carlosnsoliveira@gmail.com>
+ * \details	It contains the lock-free histogram behind the statistics of a logger.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace sqlogger {
+/**
+ * \class 	sqlogger::Histogram
+ * \brief 	A lock-free histogram of non-negative values with HDR-style buckets.
+ * \details 	Values below 8 have a bucket of their own; larger ones share a bucket with the values having the same
+ * 		leading bit and next three bits, so that any value is known within 12.5%. Recording is one relaxed atomic
+ * 		increment in a stripe picked per thread, so concurrent threads seldom share a cache line. summary() adds
+ * 		the stripes up, without stopping the recording threads.
+ */
+  class Histogram
+  {
+  public:
+    ///The distribution of the recorded values. Percentiles are the midpoints of their buckets.
+    struct Summary {
+      std::uint64_t count;
+      double mean;
+      std::uint64_t p50;
+      std::uint64_t p99;
+      std::uint64_t p999;
+      std::uint64_t max;
+    };
+    
+    ///\param stripes	1 if a single thread records at a time, more if many threads do.
+    explicit Histogram(std::size_t stripes=1);
+    Histogram(Histogram const&)=delete;
+    Histogram& operator=(Histogram const&)=delete;
+    
+    void record(std::uint64_t value) noexcept;
+    Summary summary() const;
+    
+  private:
+    static const std::size_t buckets = 8 + 61*8;
+    static std::size_t bucketOf(std::uint64_t value) noexcept;
+    static std::uint64_t valueOf(std::size_t bucket) noexcept;
+    
+    ///One stripe: its buckets, then the total of its values.
+    struct Stripe {
+      std::atomic<std::uint64_t> counts[buckets];
+      std::atomic<std::uint64_t> sum;
+      char pad[64];
+    };
+    const std::size_t stripes;
+    std::unique_ptr<Stripe[]> data;
+  };
+  
+  namespace detail {
+    ///The stripe number of the calling thread. Threads get consecutive numbers, so that up to as many threads as
+    ///stripes never share one. Used by the histograms and the samplers.
+    std::size_t threadNumber() noexcept;
+  }
+  
+}
+
+#endif
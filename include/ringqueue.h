@@ -0,0 +1,167 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+
+/**
+ * \file 	ringqueue.h
+ * \author 	Carlos Nihelton <carlosnsoliveira@gmail.com>
+ * \details	It contains the lock-free bounded queue used to hand log entries over to the writer thread.
+ */
+
+#ifndef RINGQUEUE_H
+#define RINGQUEUE_H
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <utility>
+
+namespace sqlogger {
+/**
+ * \class 	sqlogger::RingQueue
+ * \brief 	A bounded multi-producer/multi-consumer ring of pre-allocated slots.
+ * \details 	Each slot carries a sequence number telling whether it is free for the producer holding a given ticket
+ * 		or published for the consumers. Producers only contend on one compare-and-swap of the head position,
+ * 		then fill the slot in place, so slot members keep their allocated capacity from one lap to the next.
+ * 		Consumers take runs of published slots with one compare-and-swap of the tail position and copy them out,
+ * 		so a slot is free again as soon as it is taken. The capacity is rounded up to a power of two.
+ */
+  template<typename T>
+  class RingQueue
+  {
+  public:
+    explicit RingQueue(std::size_t capacity) : mask(roundUp(capacity)-1), cells(new Cell[mask+1]), head(0), tail(0)
+    {
+      for(std::size_t i=0; i<=mask; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    RingQueue(RingQueue const&)=delete;
+    RingQueue& operator=(RingQueue const&)=delete;
+    
+    ///\name 	Producer side. Any number of threads.
+    ///\{
+    /**
+     * Claims the next free slot.
+     * \param ticket	Receives the ticket to be passed to publish().
+     * \return The slot to be filled or nullptr if the ring is full.
+     */
+    T* tryClaim(std::size_t& ticket) noexcept
+    {
+      std::size_t pos = head.load(std::memory_order_relaxed);
+      for(;;) {
+	Cell& cell = cells[pos & mask];
+	std::size_t seq = cell.sequence.load(std::memory_order_acquire);
+	std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+	if(diff == 0) {
+	  if(head.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+	    ticket = pos;
+	    return &cell.data;
+	  }
+	} else if(diff < 0) {
+	  return nullptr;
+	} else {
+	  pos = head.load(std::memory_order_relaxed);
+	}
+      }
+    }
+    ///Hands a claimed slot over to the consumer.
+    void publish(std::size_t ticket) noexcept
+    {
+      cells[ticket & mask].sequence.store(ticket+1, std::memory_order_release);
+    }
+    ///\}
+    
+    ///\name 	Consumer side. Any number of threads.
+    ///\{
+    /**
+     * Takes the oldest published slots, up to the first one not published yet.
+     * \param out	Receives the taken values, oldest first.
+     * \param max	Maximum number of slots to take.
+     * \return The number of slots taken, 0 if none was published.
+     */
+    std::size_t take(T* out, std::size_t max) noexcept
+    {
+      std::size_t pos = tail.load(std::memory_order_relaxed);
+      std::size_t n;
+      for(;;) {
+	n = 0;
+	while(n < max && cells[(pos+n) & mask].sequence.load(std::memory_order_acquire) == pos+n+1) ++n;
+	if(n == 0) {
+	  //Empty, unless another consumer moved the tail meanwhile.
+	  std::size_t now = tail.load(std::memory_order_relaxed);
+	  if(now == pos) return 0;
+	  pos = now;
+	} else if(tail.compare_exchange_weak(pos, pos+n, std::memory_order_relaxed)) {
+	  break;
+	}
+      }
+      for(std::size_t i=0; i<n; ++i) {
+	Cell& cell = cells[(pos+i) & mask];
+	out[i] = std::move(cell.data);
+	cell.sequence.store(pos+i+mask+1, std::memory_order_release);
+      }
+      return n;
+    }
+    ///\return true if the oldest slot is published, i.e. take() would not return 0 if called now.
+    bool ready() const noexcept
+    {
+      std::size_t pos = tail.load(std::memory_order_relaxed);
+      return cells[pos & mask].sequence.load(std::memory_order_acquire) == pos+1;
+    }
+    ///\}
+    
+    ///Number of tickets handed out so far.
+    std::size_t claimed() const noexcept {return head.load(std::memory_order_acquire);};
+    ///\return The number of slots claimed and not taken yet. Only an estimate while other threads use the ring.
+    std::size_t size() const noexcept
+    {
+      std::size_t taken = tail.load(std::memory_order_relaxed);
+      std::size_t pos = head.load(std::memory_order_relaxed);
+      return pos > taken ? pos-taken : 0;
+    }
+    std::size_t capacity() const noexcept {return mask+1;};
+    
+  private:
+    struct Cell {
+      std::atomic<std::size_t> sequence;
+      T data;
+    };
+    
+    static std::size_t roundUp(std::size_t n) noexcept
+    {
+      std::size_t p = 2;
+      while(p < n) p <<= 1;
+      return p;
+    }
+    
+    //Padding keeps the producers' head and the consumers' tail on separate cache lines.
+    const std::size_t mask;
+    std::unique_ptr<Cell[]> cells;
+    char padHead[64];
+    std::atomic<std::size_t> head;
+    char padTail[64];
+    std::atomic<std::size_t> tail;
+  };
+  
+}
+
+#endif
@@ -0,0 +1,129 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+/**
+ * \file 	sampler.h
+ * \author 	Carlos Nihelton <carlosnsoliveira@gmail.com>
+ * \details	It contains the per-table sampling that decides which records are stored, before their fields are read.
+ */
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace sqlogger {
+  ///How the records of a table are sampled, see Options::sampling.
+  struct Sampling
+  {
+    enum Mode {SampleAll, SampleRatio, SampleReservoir, SampleRate};
+    Mode mode = SampleAll;
+    ///SampleRatio: fraction of the records kept, each drawn at random.
+    double ratio = 1.0;
+    ///SampleReservoir: a uniform sample of reservoir records out of those logged in each window, written when it ends.
+    std::size_t reservoir = 100;
+    std::chrono::milliseconds window{1000};
+    ///SampleRate: a token bucket, refilled with rate records per second, holding burst records at most.
+    double rate = 1000;
+    double burst = 100;
+  };
+  
+/**
+ * \class 	sqlogger::Sampler
+ * \brief 	The sampling state of one table.
+ * \details 	admit() decides whether a record is kept, from a thread local random number, a lock-free token bucket
+ * 		or a reservoir index, without reading the record, so that a record sampled out costs nanoseconds.
+ * 		Records held in the reservoir are kept as encoded snapshots until harvest(). The counts of records seen
+ * 		and kept are striped per thread.
+ */
+  class Sampler
+  {
+  public:
+    ///What to do with a record.
+    enum Verdict {Drop, Keep, Hold};
+    
+    explicit Sampler(const Sampling& config);
+    Sampler(Sampler const&)=delete;
+    Sampler& operator=(Sampler const&)=delete;
+    
+    /**
+     * Decides the fate of a record, before its fields are read.
+     * \param slot	Receives the reservoir slot to hold() the record in, if Hold, tagged with the window it belongs to.
+     */
+    Verdict admit(std::uint64_t& slot) noexcept;
+    ///Stores a record admitted with Hold, replacing the one in its slot. Dropped if its window was harvested meanwhile.
+    void hold(std::uint64_t slot, std::string&& record);
+    ///\return true if the reservoir window is over.
+    bool due() const noexcept;
+    ///\return When the reservoir window ends, in nanoseconds of the steady clock.
+    std::int64_t end() const noexcept;
+    ///\return The records held in the reservoir if its window is over or force is set, starting the next window.
+    std::vector<std::string> harvest(bool force);
+    
+    const Sampling& getConfig() const noexcept {return config;};
+    ///\return The records seen by admit() so far.
+    std::uint64_t seen() const noexcept;
+    ///\return The records kept so far: admitted with Keep, or harvested.
+    std::uint64_t kept() const noexcept;
+    ///Counts last written to the _sqlogger_sampling table, left to the logger.
+    std::uint64_t reportedSeen;
+    std::uint64_t reportedKept;
+    
+  private:
+    static std::int64_t now() noexcept;
+    
+    const Sampling config;
+    ///SampleRatio: records are kept if a random 64 bit number is below it.
+    std::uint64_t threshold;
+    ///SampleRate: nanoseconds per token, and how far ahead of now the bucket may be drawn.
+    std::int64_t interval;
+    std::int64_t tolerance;
+    ///SampleRate: when the bucket is refilled again, in the generic cell rate algorithm.
+    std::atomic<std::int64_t> arrival;
+    
+    ///SampleReservoir: the number of the window in the high 32 bits and the records seen in it in the low ones, so
+    ///that admit() learns both at once; then the end of the window and the records held.
+    std::atomic<std::uint64_t> window;
+    std::atomic<std::int64_t> windowEnd;
+    std::mutex heldMtx;
+    std::vector<std::string> held;
+    
+    struct Counts {
+      std::atomic<std::uint64_t> seen;
+      std::atomic<std::uint64_t> kept;
+      char pad[64 - 2*sizeof(std::uint64_t)];
+    };
+    static const std::size_t stripes = 16;
+    Counts counts[stripes];
+    std::atomic<std::uint64_t> harvested;
+  };
+  
+}
+
+#endif
@@ -0,0 +1,102 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+
+/**
+ * \file 	shardedlogger.h
+ * \author 	Carlos Nihelton <carlosnsoliveira@gmail.com>
+ * \details	It contains declaration of the ShardedLogger class, which spreads records over several database files.
+ */
+
+#ifndef SHARDEDLOGGER_H
+#define SHARDEDLOGGER_H
+
+#include <sqlogger.h>
+
+namespace sqlogger {
+/**
+ * \class 	sqlogger::ShardedLogger
+ * \brief 	Spreads records over N database files, each one with its own SQLogger.
+ * \details 	SQLite allows one writer per database file, so a single logger tops out at one core of insert throughput.
+ * 		Shards of "log.db" are named "log.0.db" to "log.N-1.db" and each one has its own connection and,
+ * 		in async mode, its own writer thread. Records go to a shard picked from the calling thread or from a user key.
+ * 		Readers see the shards as one dataset through attach() or after merge().
+ */
+  class ShardedLogger
+  {
+  public:
+    /**
+     * \param file		Name from which the shard names are derived. The index goes before the extension.
+     * \param shards	Number of shards, at least 1.
+     * \param options	Settings applied to every shard.
+     * \throw std::runtime_error if a shard cannot be opened or configured.
+     */
+    ShardedLogger(const std::string& file, std::size_t shards, const Options& options=Options());
+    ShardedLogger(ShardedLogger const&)=delete;
+    ShardedLogger& operator=(ShardedLogger const&)=delete;
+    
+    ///\name 	Logging. A thread always writes into the same shard, so its records keep their order.
+    ///\{
+    bool log(Record* rec) {return shard(std::hash<std::thread::id>()(std::this_thread::get_id())).log(rec);};
+    template<typename Table, typename... Fields>
+    bool log(const StaticRecord<Table, Fields...>& rec) {return shard(std::hash<std::thread::id>()(std::this_thread::get_id())).log(rec);};
+    ///Logs into the shard selected by key, e.g. a user or device id, so that related records stay together.
+    bool log(Record* rec, std::size_t key) {return shard(key).log(rec);};
+    template<typename Table, typename... Fields>
+    bool log(const StaticRecord<Table, Fields...>& rec, std::size_t key) {return shard(key).log(rec);};
+    ///\}
+    
+    ///Flushes every shard.
+    void flush();
+    
+    ///\return The logger of the shard selected by key.
+    SQLogger& shard(std::size_t key) {return *shards[key % shards.size()];};
+    ///\return The file name of the i-th shard.
+    const std::string& shardFile(std::size_t i) const {return files.at(i);};
+    std::size_t size() const {return shards.size();};
+    
+    ///\name 	Reading the shards as one dataset.
+    ///\{
+    /**
+     * Attaches every shard to a reader connection as shard0, shard1... and creates a TEMP view per table,
+     * named after it, with the rows of all the shards. SQLite attaches at most 10 databases by default.
+     * \param db	A connection opened by the reader.
+     * \throw std::runtime_error on SQLite errors.
+     */
+    void attach(sqlite3* db) const;
+    /**
+     * Flushes the shards and copies their rows into one database, creating the tables as needed.
+     * \param file	The target database. Rows are appended if it already has them.
+     * \throw std::runtime_error on SQLite errors.
+     */
+    void merge(const std::string& file);
+    ///\}
+    
+  private:
+    std::vector<std::string> files;
+    std::vector<std::unique_ptr<SQLogger>> shards;
+  };
+  
+}
+
+#endif
@@ -0,0 +1,126 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+
+/**
+ * \file 	spill.h
+ * \author 	Carlos Nihelton <carlosnsoliveira@gmail.com>
+ * \details	It contains the memory-mapped segment files records are spilled into in spill mode.
+ */
+
+#ifndef SPILL_H
+#define SPILL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace sqlogger {
+/**
+ * \class 	sqlogger::SpillSegment
+ * \brief 	An append-only file of length-prefixed records, mapped in memory.
+ * \details 	The file is allocated on disk when the segment is created, so appending never grows it. Producers reserve
+ * 		room with one atomic addition, copy their record in and flag it ready. One consumer reads the records back in
+ * 		order. Each record is an 8 byte header, its length and its state, followed by its bytes padded to 8 bytes.
+ * 		The mapping is shared with the file, so the records of a crashed process are found in it on the next start;
+ * 		a record that was still being written is flagged torn and skipped. The consumer checkpoints its read position
+ * 		in the file, so that records ingested before a crash can be told apart.
+ */
+  class SpillSegment
+  {
+  public:
+    ///What the consumer finds at a given offset.
+    enum Status {Ready, Pending, Torn, End};
+    
+    /**
+     * Creates a segment file.
+     * \param number	Rank of the segment, in the order records were written.
+     * \throw std::runtime_error if the file cannot be created, allocated or mapped.
+     */
+    SpillSegment(const std::string& file, std::uint64_t number, std::size_t capacity);
+    /**
+     * Maps a segment file left by a former process. It is sealed: only read back, never written.
+     * \throw std::runtime_error if the file cannot be mapped or is not a segment.
+     */
+    SpillSegment(const std::string& file, std::uint64_t number);
+    SpillSegment(SpillSegment const&)=delete;
+    SpillSegment& operator=(SpillSegment const&)=delete;
+    ~SpillSegment();
+    
+    ///\name 	Producer side. A producer reserves and publishes between enter() and leave().
+    ///\{
+    void enter() noexcept {active.fetch_add(1, std::memory_order_seq_cst);};
+    void leave() noexcept {active.fetch_sub(1, std::memory_order_release);};
+    ///\return Room for size bytes, or nullptr if the segment is full or sealed.
+    char* reserve(std::size_t size) noexcept;
+    ///Flags a record returned by reserve() as ready for the consumer.
+    static void publish(char* record) noexcept;
+    ///Makes every later reserve() fail. Records reserved before are still published.
+    void seal() noexcept;
+    ///\}
+    
+    ///\name 	Consumer side. One thread only.
+    ///\{
+    /**
+     * Examines the record at the read position, moving past it unless it is Pending or the End.
+     * \param data	Receives the record bytes if it is Ready.
+     * \param size	Receives their number.
+     */
+    Status next(const char*& data, std::size_t& size) noexcept;
+    ///\return true once sealed and no producer is left inside, i.e. Pending records are in fact torn.
+    bool quiescent() const noexcept;
+    ///Saves the read position in the file, where a restart resumes reading. Called once the records read are safe.
+    void checkpoint() noexcept;
+    ///\return The checkpoint a former process left: the records before it were ingested already. 0 if none.
+    std::size_t checkpointed() const noexcept {return saved;};
+    ///Position of the next record to read.
+    std::size_t position() const noexcept {return readPos;};
+    ///Unmaps the segment and removes its file. The object itself stays valid for late producers.
+    void discard() noexcept;
+    ///\}
+    
+    std::uint64_t number() const noexcept {return rank;};
+    std::size_t capacity() const noexcept {return size;};
+    ///\return The end of the room reserved so far.
+    std::size_t reserved() const noexcept;
+    ///\return The largest record reserve() may ever accept.
+    static std::size_t maxRecord(std::size_t capacity) noexcept;
+    
+  private:
+    void map(int fd);
+    
+    const std::string file;
+    const std::uint64_t rank;
+    std::size_t size;
+    char* base;
+    std::atomic<std::size_t> tail;
+    std::atomic<int> active;
+    std::atomic<bool> sealed;
+    std::size_t readPos;
+    std::size_t saved;
+  };
+  
+}
+
+#endif
@@ -33,6 +33,7 @@
 
 
 #include <string>
+#include <cstdint>
 #include <sstream>
 #include <ctime>
 #include <iomanip>
@@ -41,10 +42,184 @@
 #include <memory>
 #include <vector>
 #include <stdexcept>
+#include <type_traits>
+#include <mutex>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <chrono>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
 
 #include <sqlite/sqlite3.h>
+#include <ringqueue.h>
+#include <arena.h>
+#include <metrics.h>
+#include <spill.h>
+#include <crashring.h>
+#include <sampler.h>
 
 namespace sqlogger {  
+  template<typename Table, typename... Fields> class StaticRecord;
+  
+  ///A non-owning view of text returned by a field callback. The viewed bytes must outlive the log() call.
+  struct TextRef
+  {
+    const char* data;
+    std::size_t size;
+  };
+  
+  ///A non-owning view of binary data returned by a field callback. The viewed bytes must outlive the log() call.
+  struct BlobRef
+  {
+    const void* data;
+    std::size_t size;
+  };
+  
+/**
+ * \class 	sqlogger::Value
+ * \brief 	A field value captured from a Record, ready to be bound to a prepared statement.
+ * \details 	It holds one of the SQLite storage classes. Text and blobs are kept in an internal buffer
+ * 		whose capacity is reused when the same Value is assigned again, or only viewed: a view is bound with
+ * 		SQLITE_STATIC in sync mode and copied once, into the snapshot, in async mode.
+ */
+  class Value
+  {
+  public:
+    enum Type {Null, Integer, Real, Text, Blob};
+    
+    Value() : type(Null), integer(0), view(nullptr), viewSize(0) {};
+    
+    ///\name 	Setters, one per storage class.
+    ///\{
+    void setNull() noexcept {type = Null;};
+    void setInteger(std::int64_t v) noexcept {type = Integer; integer = v;};
+    void setReal(double v) noexcept {type = Real; real = v;};
+    void setText(const std::string& v) {type = Text; view = nullptr; bytes.assign(v);};
+    void setText(std::string&& v) {type = Text; view = nullptr; bytes = std::move(v);};
+    void setText(const char* v, std::size_t n) {type = Text; view = nullptr; bytes.assign(v, n);};
+    void setBlob(const void* v, std::size_t n) {type = Blob; view = nullptr; bytes.assign(static_cast<const char*>(v), n);};
+    ///\}
+    
+    ///\name 	Views of text or blobs owned by the record, which must outlive the log() call. Nothing is copied.
+    ///\{
+    void setTextView(const char* v, std::size_t n) noexcept {type = Text; view = v ? v : ""; viewSize = n;};
+    void setBlobView(const void* v, std::size_t n) noexcept {type = Blob; view = v ? static_cast<const char*>(v) : ""; viewSize = n;};
+    bool isView() const noexcept {return view != nullptr;};
+    ///\}
+    
+    ///\name 	Getters. Only the one matching getType() is meaningful.
+    ///\{
+    Type getType() const noexcept {return type;};
+    std::int64_t asInteger() const noexcept {return integer;};
+    double asReal() const noexcept {return real;};
+    const char* data() const noexcept {return view ? view : bytes.data();};
+    std::size_t size() const noexcept {return view ? viewSize : bytes.size();};
+    ///\}
+    
+  private:
+    Type type;
+    union {
+      std::int64_t integer;
+      double real;
+    };
+    std::string bytes;
+    const char* view;
+    std::size_t viewSize;
+  };
+  
+/**
+ * \class 	sqlogger::Snapshot
+ * \brief 	A compact binary copy of the values of a record, taken when it is logged in async mode.
+ * \details 	Each value is encoded as a one byte storage class followed by 8 bytes for numbers, or by a 4 byte length
+ * 		and the bytes themselves for text and blobs. The snapshot does not own the buffer it refers to,
+ * 		and no longer depends on the Record, which may be reused or destroyed as soon as log() returns.
+ */
+  class Snapshot
+  {
+  public:
+    Snapshot() : bytes(nullptr), length(0) {};
+    Snapshot(const char* bytes, std::size_t length) : bytes(bytes), length(length) {};
+    
+    ///\return The number of bytes encode() needs for the values.
+    static std::size_t measure(const std::vector<Value>& values) noexcept;
+    /**
+     * Encodes the values.
+     * \param buffer	At least measure(values) bytes.
+     * \return The snapshot of the values, referring to buffer.
+     */
+    static Snapshot encode(const std::vector<Value>& values, char* buffer) noexcept;
+    
+    const char* data() const noexcept {return bytes;};
+    std::size_t size() const noexcept {return length;};
+    
+  /**
+   * \class 	sqlogger::Snapshot::Cursor
+   * \brief 	Reads the values of a snapshot back, in order, without copying text or blobs.
+   */
+    class Cursor
+    {
+    public:
+      explicit Cursor(const Snapshot& snapshot) : pos(snapshot.bytes), end(snapshot.bytes+snapshot.length), type(Value::Null), integer(0), length(0), bytes(nullptr) {};
+      ///Moves to the next value. \return false if there is none.
+      bool next() noexcept;
+      
+      ///\name 	The current value. Only the getter matching getType() is meaningful.
+      ///\{
+      Value::Type getType() const noexcept {return type;};
+      std::int64_t asInteger() const noexcept {return integer;};
+      double asReal() const noexcept {return real;};
+      const char* data() const noexcept {return bytes;};
+      std::size_t size() const noexcept {return length;};
+      ///\}
+      
+    private:
+      const char* pos;
+      const char* end;
+      Value::Type type;
+      union {
+	std::int64_t integer;
+	double real;
+      };
+      std::size_t length;
+      const char* bytes;
+    };
+    
+  private:
+    const char* bytes;
+    std::size_t length;
+  };
+  
+/**
+ * \class 	sqlogger::Timestamp
+ * \brief 	Fast clock readings for the MOMENT column.
+ * \details 	Text timestamps keep the ISO-8601 like "%Y-%m-%d %H-%M-%S" format. The formatted seconds are cached per thread
+ * 		and only formatted again when the second changes, so localtime_r and strftime run at most once per second
+ * 		per thread. Sub-second digits are appended to the cached prefix.
+ */
+  class Timestamp
+  {
+  public:
+    ///Storage format of a timestamp.
+    enum Format {
+      Seconds,		///< TEXT, second resolution. The default.
+      Milliseconds,	///< TEXT, with 3 decimal places.
+      Microseconds,	///< TEXT, with 6 decimal places.
+      EpochNanoseconds	///< INTEGER, nanoseconds since the Unix epoch. Strictly ordered within a thread on most hosts.
+    };
+    
+    ///Stores the current time into a Value in the given format.
+    static void now(Format format, Value& value);
+    ///\return The current time as nanoseconds since the Unix epoch. Usable as an addField callback for an extra column.
+    static std::int64_t epochNanoseconds();
+    ///\return The SQLite type of a column holding timestamps in the given format.
+    static const char* typeDesc(Format format) {return format == EpochNanoseconds ? "INTEGER" : "TEXT";};
+  };
+  
 /**
 * \class 	sqlogger::Record
 * \brief 	A base class proiding the interfaces required for the logger class.
@@ -63,8 +238,15 @@ namespace sqlogger {
   protected:
     ///name 	Protected methods invoked by SQLogger when logging back user's stuff.
     ///\{
-    const std::string writeQuery();
-    const std::string& getSchema(){updateSchema(); return schema;};
+    const std::string& writeQuery() const {return query;};
+    const std::string& getSchema() const {return schema;};
+    const std::string& getTableName() const {return tableName;};
+    /**
+     * Captures the current value of every field, in the same order as the parameters of writeQuery().
+     * \param values	Receives one Value per field. Its elements are reused, so passing the same vector
+     * 			on every call avoids reallocating the text buffers.
+     */
+    void readValues(std::vector<Value>& values);
     ///\}
     
     ///\name 	protected member functions that must be used by the inherited classes.
@@ -76,8 +258,15 @@ namespace sqlogger {
      * \param tblName	A std::string object holding the table name.
      */
     void setTableName(const std::string& tblName) noexcept; 
+    /**
+     * Selects the storage format of the MOMENT column, Timestamp::Seconds by default.
+     * Like setTableName, it is meant to be called during inherited object construction.
+     * \param format	The format, which also sets the column type: TEXT or INTEGER.
+     */
+    void setTimeFormat(Timestamp::Format format);
     /**
      * This function updates database schema based on fields description and log table name.
+     * The parameterized INSERT statement returned by writeQuery() is rebuilt along with it.
      * \param void
      */
     void updateSchema() noexcept;
@@ -89,63 +278,740 @@ namespace sqlogger {
      * 				It is recommended to be a member function of the derived class which converts the data member into string.
      */
     void addField(const std::string& fieldName, const std::string& typeDesc, std::function<const std::string(void)> callback);
+    /**
+     * \name 	Typed overloads of addField.
+     * \details 	The value is bound in its native SQLite storage class instead of being formatted as text,
+     * 		so typeDesc should have a matching affinity: INTEGER, REAL, TEXT or BLOB.
+     * \{ */
+    void addField(const std::string& fieldName, const std::string& typeDesc, std::function<std::int64_t(void)> callback);
+    void addField(const std::string& fieldName, const std::string& typeDesc, std::function<double(void)> callback);
+    void addField(const std::string& fieldName, const std::string& typeDesc, std::function<TextRef(void)> callback);
+    void addField(const std::string& fieldName, const std::string& typeDesc, std::function<BlobRef(void)> callback);
+#if __cplusplus >= 201703L
+    void addField(const std::string& fieldName, const std::string& typeDesc, std::function<std::string_view(void)> callback);
+#endif
+    /**
+     * Picks the overload from the callback's return type: integers and bools as INTEGER, floating point as REAL,
+     * TextRef, BlobRef and std::string_view as such, anything else converted to std::string.
+     * It spares std::bind expressions and lambdas from the ambiguity between the std::function overloads.
+     */
+    template<typename Callable>
+    void addField(const std::string& fieldName, const std::string& typeDesc, Callable callback)
+    {
+      typedef typename std::decay<decltype(callback())>::type Result;
+      addField(fieldName, typeDesc, std::function<typename FieldType<Result>::type(void)>(callback));
+    }
+    ///\}
     ///\}  
     ///A default constructor providing the most basic information for the logging system. Only accessible to the inherited classes.
     Record();
     
   private:
+    ///Maps a callback return type to the return type of the addField overload handling it.
+    template<typename T, typename Enable=void>
+    struct FieldType {typedef const std::string type;};
+    template<typename T>
+    struct FieldType<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type> {typedef std::int64_t type;};
+    template<typename T>
+    struct FieldType<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {typedef double type;};
+    template<typename T>
+    struct FieldType<T, typename std::enable_if<std::is_same<T, TextRef>::value || std::is_same<T, BlobRef>::value>::type> {typedef T type;};
+#if __cplusplus >= 201703L
+    template<typename T>
+    struct FieldType<T, typename std::enable_if<std::is_same<T, std::string_view>::value>::type> {typedef T type;};
+#endif
+    
+    ///Validates and appends a field whose fetcher stores the callback result into a Value.
+    void addFetcher(const std::string& fieldName, const std::string& typeDesc, std::function<void(Value&)> fetcher);
+    
     /**
      * \name Protected data members altered by derived classes.
      * \{ */
-      std::vector<std::tuple<std::string, std::string, std::function<const std::string(void)>>> fields;
+      std::vector<std::tuple<std::string, std::string, std::function<void(Value&)>>> fields;
       std::string schema;
+      std::string query;
       std::string tableName;
     ///\}
       
+      ///\name Declaring SQLogger as friend allows access to the protected member functions.
+    friend class SQLogger;
+    template<typename Table, typename... Fields> friend class StaticRecord;
+  };
+  
+/**
+ * \struct sqlogger::Options
+ * \brief Settings applied when the logger is created.
+ * \details The database settings are applied as PRAGMAs right after the file is opened. Each of them has a value
+ * 		meaning "keep SQLite's default". SQLogger::getOptions() reports the values actually in effect.
+ */
+  struct Options
+  {
+    enum Synchronous {SyncDefault=-1, SyncOff=0, SyncNormal=1, SyncFull=2, SyncExtra=3};
+    enum TempStore {TempDefault=0, TempFile=1, TempMemory=2};
+    enum Overflow {OverflowBlock, OverflowDropNewest, OverflowDropOldest, OverflowSample};
+    
+    ///\name Database settings.
+    ///\{
+    ///PRAGMA journal_mode, e.g. "WAL", "DELETE", "TRUNCATE", "MEMORY". Empty keeps the default.
+    std::string journalMode;
+    ///PRAGMA synchronous. The main durability versus throughput lever; NORMAL is durable enough with WAL.
+    Synchronous synchronous = SyncDefault;
+    ///PRAGMA cache_size: pages if positive, KiB if negative. 0 keeps the default.
+    std::int64_t cacheSize = 0;
+    ///PRAGMA mmap_size in bytes. -1 keeps the default.
+    std::int64_t mmapSize = -1;
+    ///PRAGMA temp_store.
+    TempStore tempStore = TempDefault;
+    ///PRAGMA wal_autocheckpoint in pages; 0 disables automatic checkpoints. -1 keeps the default.
+    int walAutocheckpoint = -1;
+    ///\}
+    
+
+    ///When true, SQLogger::log only queues the record and a background thread writes it into the database.
+    bool async = false;
+    ///Number of slots of the queue used in async mode. Rounded up to a power of two.
+    std::size_t queueCapacity = 4096;
+    /**
+     * What SQLogger::log does in async mode when the queue is full: wait for a slot, at most overflowTimeout,
+     * drop the new record or evict the oldest queued one. OverflowSample also thins the stream out once the queue
+     * is half full, queueing one record out of sampleRate, and drops the new record when the queue is full.
+     * Dropped records are counted, see SQLogger::dropped().
+     */
+    Overflow overflow = OverflowBlock;
+    ///Longest wait for a slot with OverflowBlock before the record is dropped. Negative waits as long as needed.
+    std::chrono::milliseconds overflowTimeout{-1};
+    ///One record out of sampleRate is queued by OverflowSample while the queue is more than half full.
+    std::size_t sampleRate = 10;
+    ///Period of the rows counting dropped records in the _sqlogger_overflow table. 0 disables them.
+    std::chrono::milliseconds overflowReport{10000};
+    /**
+     * Sampling of the records of some tables, by table name, decided by SQLogger::log before any field callback runs.
+     * log() returns true for a record sampled out. The records seen and kept per table since the previous row are
+     * written into the _sqlogger_sampling table every samplingReport and when the logger is destroyed, so that
+     * totals can be rescaled: SUM(SEEN)/SUM(KEPT) records were logged per record stored.
+     */
+    std::unordered_map<std::string, Sampling> sampling;
+    ///Period of the rows of the _sqlogger_sampling table. 0 only writes them when the logger is destroyed.
+    std::chrono::milliseconds samplingReport{10000};
+    /**
+     * Group commit: records are inserted inside explicit transactions of up to batchSize records,
+     * committed earlier if batchDelay has elapsed since the transaction began. 1 keeps autocommit per record.
+     */
+    std::size_t batchSize = 1;
+    ///Longest time a record may wait uncommitted when batchSize is greater than 1. In synchronous mode a writer thread
+    ///then commits the batch by its deadline, even if nothing is logged meanwhile.
+    std::chrono::milliseconds batchDelay{100};
+    /**
+     * Rows of the same table written together, by the async writer or a bulk log call, are inserted with
+     * multi-row INSERT statements of 128, 32 or 8 rows, as allowed by SQLite's variable limit, saving one step per row.
+     */
+    bool multiRowInsert = true;
+    /**
+     * Spill mode: SQLogger::log appends the record to a memory-mapped segment file, named after the database file
+     * with a .spill.N suffix, and a background thread ingests the segments into the database, in one transaction
+     * per pass over the records found, at least every batchDelay. Segments left by a crashed process are ingested
+     * first on the next start. Takes precedence over async.
+     */
+    bool spill = false;
+    ///Size of a segment file in bytes, allocated when the segment is created. Larger records are dropped.
+    std::size_t spillSegmentSize = 64*1024*1024;
     /**
-     * \name Member function the get the current time in ISO-8601 format string.
-     * \details The minimum data provided by this base class is the time when the user performs a log call.
+     * Path of a crash ring file, e.g. on /dev/shm, or empty for none. In async mode every queued record is also copied
+     * into this memory-mapped ring until it is committed, so that the records of a process that dies are not lost
+     * with its queue: the next SQLogger opened with the same ring writes them into its database before anything else.
+     * A record may be written twice if the process dies right after its commit.
      */
-    const std::string getTime();
+    std::string crashRing;
+    ///Number of records the crash ring holds; the oldest are overwritten first.
+    std::size_t crashRingSlots = 4096;
+    ///Size of a crash ring slot in bytes, with a 16 byte header. Larger records are queued but not kept in the ring.
+    std::size_t crashRingSlotSize = 512;
     
-      ///\name Declaring SQLogger as friend allows access to the protected member functions.
-    friend class SQLogger;
+    /**
+     * \name Rotation.
+     * Once a limit is reached the logger commits and switches to a new file, so that each record is in exactly one file.
+     * With a period, files are named after the period they cover, e.g. log-2026-10-18T14.db for hourly files of log.db.
+     * Files started because of the size or row limit get a sequence number, e.g. log-2026-10-18T14-1.db, or log-1.db
+     * without period. A restarted logger goes on with the last file of the current period. Ignored for in-memory databases.
+     * The next file is opened ahead of time, so a switch costs no file creation. In async and spill modes the writer
+     * closes the former file and opens the next one. In synchronous mode, the log() call whose commit triggers the
+     * switch does it instead, unless the batch deadline commits first, and waits for it, including the final WAL
+     * checkpoint of the former file.
+     */
+    ///\{
+    ///Size of a file in bytes, 0 for no limit. Checked at commits, so a file may exceed it by one transaction.
+    std::int64_t rotateSize = 0;
+    ///Rows written into a file since it was opened, 0 for no limit.
+    std::int64_t rotateRows = 0;
+    ///Period covered by a file, e.g. std::chrono::hours(1), aligned on local midnight if it divides a day. 0 for no period.
+    std::chrono::seconds rotatePeriod{0};
+    ///\}
+    
+    /**
+     * \name Retention.
+     * Records whose MOMENT is older than retention are deleted pruneChunk rows at a time, oldest rowids first, at commits
+     * with no transaction open, i.e. between the writer's batches in async mode. No delete holds the database for long.
+     * With rotation, files of this logger last modified before the retention are removed as a whole.
+     * New files are created with auto_vacuum=INCREMENTAL and each chunk is followed by an incremental_vacuum,
+     * so that the file shrinks a little at a time. Existing files keep their auto_vacuum mode.
+     */
+    ///\{
+    ///How long records are kept, e.g. std::chrono::hours(24*7). 0 keeps them forever.
+    std::chrono::seconds retention{0};
+    ///Rows deleted by one step.
+    std::size_t pruneChunk = 1000;
+    ///Time between the starts of two passes over the tables.
+    std::chrono::milliseconds pruneInterval{1000};
+    ///Free pages given back to the file system after each step.
+    int vacuumPages = 128;
+    ///\}
+    
+    ///Longest time the writer retries a statement while another connection holds the database. 0, the default, fails at once.
+    std::chrono::milliseconds busyTimeout{0};
+    ///Period of the rows written into the _sqlogger_stats table with the values of SQLogger::stats(). 0 disables them.
+    std::chrono::seconds statsInterval{0};
+  };
+  
+/**
+ * \struct 	sqlogger::Stats
+ * \brief 	A snapshot of the metrics of a logger, returned by SQLogger::stats().
+ * \details 	Counters run since the logger was created. Times are in nanoseconds.
+ */
+  struct Stats
+  {
+    ///\name Counters.
+    ///\{
+    std::uint64_t records;	///< Records handed to SQLite.
+    std::uint64_t failed;	///< Records refused by SQLite or lost by a failed commit.
+    std::uint64_t dropped;	///< Records dropped by the overflow policy or by tryLog().
+    std::uint64_t commits;	///< Commits of at least one record, autocommits included.
+    std::uint64_t bytes;	///< Bytes of values handed to SQLite, as measured by Snapshot::measure().
+    std::uint64_t copied;	///< Text and blob bytes copied to capture records: fields not returning views, and snapshots.
+    std::uint64_t busyRetries;	///< Times the writer waited for another connection to release the database.
+    std::uint64_t prepares;	///< Statements prepared by the writer.
+    std::uint64_t prepareTime;	///< Total time spent preparing them.
+    std::size_t queueDepth;	///< Entries queued right now, 0 in synchronous mode.
+    std::size_t queueHighWater;	///< Most entries ever seen queued by the writer.
+    ///\}
+    
+    ///\name Distributions.
+    ///\{
+    Histogram::Summary log;	///< Duration of log calls; in async mode, the time to queue the record.
+    Histogram::Summary write;	///< Duration of the inserts of a record or of a run of records.
+    Histogram::Summary commit;	///< Duration of COMMIT statements.
+    Histogram::Summary endToEnd;	///< Time from log call to commit of each record.
+    Histogram::Summary batch;	///< Records per commit.
+    ///\}
+    
+    Arena::Stats arena;
   };
   
 /**
  * \class SQLogger
  * \brief A Singleton to log stuff into a SQLite database.
  * \details The user must provide the scheme for the database and a mimic class for the records and this class must have derive from Record class.
+ * 		Besides the singleton returned by instance(), loggers may be constructed directly to write into other files
+ * 		with other options. Each one owns its connection, writer thread and statement cache.
  */
   class SQLogger
   {
   public:
+    /**
+     * Opens a logger independent from the singleton.
+     * \param file 	The SQLite3 file into which the log will be written. Two loggers should not share a file.
+     * \param options	Settings of the logger.
+     * \throw std::runtime_error if the file cannot be opened or configured.
+     */
+    explicit SQLogger(const std::string& file, const Options& options=Options());
+    ///Drains the queue and commits the pending batch, if any, before closing the database.
+    virtual ~SQLogger();
+    
+
     //bool log(std::unique_ptr<Record> rec);
+    /**
+     * Logs the current values of a record.
+     * In async mode the values are copied into a queue slot and the function returns once they are queued,
+     * blocking only while the queue is full. The record may be destroyed right after the call.
+     * \return true if the record was written or, in async mode, queued. With batching, written means inserted
+     * 		 in the open transaction, which becomes durable once it is committed.
+     */
     bool log(Record* rec);
+    /**
+     * Logs a record without waiting, whatever the overflow policy: in async mode the record is dropped if the queue
+     * is full, in synchronous mode if another thread is using the database connection.
+     * \return true if the record was queued or written, false if it was dropped or could not be written.
+     */
+    bool tryLog(Record* rec);
+    /**
+     * Logs a batch of records with one lock, one transaction and one prepared statement per table.
+     * In async mode the records are queued and the writer inserts them inside one transaction.
+     * \param recs	The records. Records without table name or fields are not logged.
+     * \return One flag per record, true if it was logged as log(Record*) would report it.
+     */
+    std::vector<bool> log(const std::vector<Record*>& recs);
+    ///Same as log(const std::vector<Record*>&) for any range of Record pointers.
+    template<typename Iterator>
+    std::vector<bool> log(Iterator begin, Iterator end) {return log(std::vector<Record*>(begin, end));};
+    /**
+     * Logs a StaticRecord. Defined in staticrecord.h.
+     * \return The same as log(Record*).
+     */
+    template<typename Table, typename... Fields>
+    bool log(const StaticRecord<Table, Fields...>& rec);
+    /**
+     * Waits until every record logged before this call has been written into the database and committed.
+     * In synchronous mode it commits the open batch, if any. The records held in reservoirs are written as well,
+     * starting their next window.
+     */
+    void flush();
     
     /**
      * Meyers-Singleton design.
      * 
-     * This method is the only way the user can create and/or access <b> SQLogger instance</b>.
+     * This method is the way the user can create and/or access the shared <b> SQLogger instance</b>.
      * \param file 	A std::string object holding the desired name for the SQLite3 file into which the log will be written.
      * 			If not provided, the default ./log.db will be used.
+     * \param options	Settings of the logger. Like the file name, they only take effect on the first call.
      * \return A static const reference to the logger object created.
      */
-    static SQLogger& instance(const std::string& file=std::string{"log.db"}) {
-      static SQLogger theLogger(file);
+    static SQLogger& instance(const std::string& file=std::string{"log.db"}, const Options& options=Options()) {
+      static SQLogger theLogger(file, options);
       return theLogger;
     }
     
+    ///Receives a result row of query(), one Value per column.
+    typedef std::function<void(const std::vector<Value>&)> RowHandler;
+    /**
+     * Runs a statement on a read-only connection owned by the calling thread, opened on its first query.
+     * The first query switches the database to the "WAL" journal mode, so that readers and the writer never wait for
+     * each other. Only committed records are visible, flush() first to see them all.
+     * On an in-memory database, which other connections cannot open, it runs on the writer's connection.
+     * \param sql	One SQL statement. It is prepared once per thread and kept.
+     * \param params	The values of its parameters.
+     * \param row	Called for each row of the result.
+     * \return The number of rows.
+     * \throw std::runtime_error if the statement cannot be prepared, is not read-only or fails, or if the database
+     * refuses the "WAL" journal mode.
+     */
+    std::size_t query(const std::string& sql, const std::vector<Value>& params, const RowHandler& row);
+    ///Same as query(sql, params, row) for a statement without parameters.
+    std::size_t query(const std::string& sql, const RowHandler& row) {return query(sql, std::vector<Value>(), row);};
+    
+    ///\return The current values of the metrics. Safe to call from any thread, it does not wait for the writer.
+    Stats stats() const;
+    
+    ///\return The number of records dropped so far by the overflow policy or by tryLog().
+    std::size_t dropped() const {return droppedCount.load(std::memory_order_relaxed);};
+    
+    ///\return The file being written into, which changes with rotation.
+    std::string getFileName();
+    
+    ///\return The options the logger was created with, the database settings replaced by the values in effect.
+    const Options& getOptions() const {return effective;};
+    
   private:
-    SQLogger(const std::string& file);
+    /**
+     * A table known to the logger. It is created in the database and its INSERT is prepared on the first write.
+     * The sqlite members are guarded by mtx; the strings never change once registered.
+     */
+    struct TableInfo {
+      TableInfo(const std::string& name, const std::string& schema, const std::string& query, std::uint32_t id);
+      ///\return The INSERT statement of the given number of rows.
+      std::string rowsQuery(std::size_t rows) const;
+      
+      const std::string name;
+      const std::string schema;
+      const std::string query;
+      ///Number of columns, i.e. parameters of query.
+      const std::size_t columns;
+      sqlite3_stmt* insert;
+      ///Multi-row INSERT statements, one per size in rowBlocks.
+      sqlite3_stmt* insertRows[3];
+      bool created;
+      ///Identifies the table in spill segments.
+      const std::uint32_t id;
+      ///Number of the last spill segment the table was described in.
+      std::atomic<std::uint64_t> spilledIn;
+      ///Set if Options::sampling names the table.
+      std::unique_ptr<Sampler> sampler;
+    };
+    ///Sizes of the multi-row INSERT statements, largest first.
+    static const std::size_t rowBlocks[3];
+    
+    ///A queue slot holding everything the writer thread needs to insert one record.
+    struct Entry {
+      TableInfo* table;
+      Snapshot snapshot;
+      ///Backing store of snapshot, from the producer's Arena. The writer returns it once the entry is committed.
+      Arena::Block block;
+      ///true if the next entries of the same bulk log call belong to the same transaction.
+      bool more;
+      ///When the record was logged, in ticks().
+      std::int64_t since;
+      ///Ticket of its copy in the crash ring, 0 if none.
+      std::uint64_t kept;
+      ///Text and blob bytes copied to capture the record, accounted by the writer.
+      std::size_t copied;
+    };
+    
+    ///A read-only connection of one thread and its statement cache, closed with it.
+    struct ReadConnection {
+      typedef std::list<std::pair<std::string, sqlite3_stmt*>> Statements;
+      ///Statements kept at most, the least recently used idle ones are finalized beyond it.
+      static const std::size_t maxStatements = 64;
+      
+      ReadConnection(sqlite3* db, std::size_t generation) : db(db), generation(generation) {};
+      ReadConnection(ReadConnection const&)=delete;
+      ReadConnection& operator=(ReadConnection const&)=delete;
+      ~ReadConnection();
+      ///\return The statement cached for sql, prepared on a miss. \throw std::runtime_error if it cannot be prepared.
+      sqlite3_stmt* statement(const std::string& sql);
+      
+      sqlite3* db;
+      ///Rotations of the log file when db was opened.
+      std::size_t generation;
+      ///Most recently used first, and their positions by SQL.
+      Statements statements;
+      std::unordered_map<std::string, Statements::iterator> positions;
+    };
+    ///Read connections by thread, shared with the threads that own them so that each one closes its own when it exits.
+    struct ReaderSet {
+      std::mutex mtx;
+      std::unordered_map<std::thread::id, std::unique_ptr<ReadConnection>> connections;
+    };
+    
     SQLogger(SQLogger const&)=delete;
     SQLogger& operator=(SQLogger const&)=delete;
-    virtual ~SQLogger();
+    
+    /**
+     * Opens a database file and applies the settings of the options to it.
+     * \return The connection. \throw std::runtime_error if the file cannot be opened or configured.
+     */
+    sqlite3* open(const std::string& file, const Options& options);
+    ///Removes the pre-opened file if unused, then closes the connections with their statements.
+    void close();
+    ///Applies the database settings of the options to dbHandle and reads back the values in effect.
+    void configure(const Options& options);
+    /**
+     * Runs a PRAGMA statement.
+     * \return The first column of its first row as text, empty if it returns no row.
+     */
+    std::string pragma(const std::string& statement);
+    
+    /**
+     * Looks up the prepared statement cached for a query, preparing it on the first use.
+     * \return The cached statement or nullptr if it could not be prepared. Must be called with mtx locked.
+     */
+    sqlite3_stmt* statement(const std::string& query);
+    ///sqlite3_prepare_v2 on dbHandle, timed and counted.
+    int compile(const std::string& sql, sqlite3_stmt** stmt);
+    ///Busy handler of the writer's connections: counts the retries and sleeps until Options::busyTimeout is over.
+    static int busy(void* self, int count);
+    ///Switches the database to the "WAL" journal mode, committing the open batch first. \throw std::runtime_error if refused.
+    void enableWal();
+    ///\return The read-only connection of the calling thread, opened on the first call.
+    ReadConnection& readConnection();
+    ///\return The reader sets of the loggers the calling thread has a connection in, emptied of it when it exits.
+    static std::vector<std::weak_ptr<ReaderSet>>& threadReaders();
+    ///Steps a query to its end, passing each row to the handler, and resets it. \param db Its connection, for errors.
+    static std::size_t fetch(sqlite3* db, sqlite3_stmt* stmt, const std::vector<Value>& params, const RowHandler& row);
+    /**
+     * Finds the table a record is written into, registering it on the first use.
+     * Records of the same table with other columns, e.g. of another Record type, get a TableInfo of their own, so
+     * that each INSERT is prepared once however the records alternate.
+     * \return The table, which stays valid until the logger is destroyed.
+     */
+    TableInfo* lookup(const std::string& name, const std::string& schema, const std::string& query);
+    ///The same as lookup(), called with tablesMtx already locked.
+    TableInfo* find(const std::string& name, const std::string& schema, const std::string& query);
+    /**
+     * Binds each Value to the parameter of the same position with the function matching its storage class.
+     * \return true if all the values were bound.
+     */
+    static bool bind(sqlite3_stmt* stmt, const std::vector<Value>& values, int first=1);
+    static bool bind(sqlite3_stmt* stmt, const Snapshot& snapshot, int first=1);
+    ///Steps an INSERT statement and resets it for the next use. \return true if it succeeded.
+    static bool step(sqlite3_stmt* stmt);
+    ///Creates the table and prepares its INSERT on the first use. Must be called with mtx locked.
+    bool prepare(TableInfo& table);
+    /**
+     * Creates the table on the first use and inserts one record. Must be called with mtx locked.
+     * \return true if the record was inserted.
+     */
+    template<typename Row>
+    bool write(TableInfo& table, const Row& row);
+    /**
+     * Inserts several rows of the same table, with multi-row statements when enabled. Must be called with mtx locked.
+     * A block whose statement fails is inserted again row by row, so that only the failing rows are lost.
+     * Rows are value vectors in synchronous mode and snapshots in async mode.
+     * \param logged	If not null, receives one flag per row.
+     */
+    template<typename Row>
+    void write(TableInfo& table, const Row* const* rows, std::size_t n, bool* logged);
+    ///\name Group commit. Must be called with mtx locked.
+    ///\{
+    ///Opens a transaction if batching is enabled, or always is true, and none is open.
+    void begin(bool always=false);
+    /**
+     * Commits the open transaction, if any. While another connection holds the database, the transaction is left open
+     * and COMMIT is tried again by a later call, unless force is set; other failures roll it back.
+     * \return false if the transaction is still open or was rolled back.
+     */
+    bool commit(bool force=false);
+    ///Commits, waiting a few seconds at most for other connections to release the database. \return As commit().
+    bool settle();
+    ///true if the open transaction reached Options::batchSize records or Options::batchDelay.
+    bool batchDue() const;
+    ///\}
+    ///Captures the values of a record of any kind into a vector of values.
+    typedef void (*Reader)(const void* source, std::vector<Value>& values);
+    ///The Reader of Record objects.
+    static void readRecord(const void* source, std::vector<Value>& values);
+    /**
+     * Common path of the log() overloads: captures the values through the reader and writes or queues them.
+     * \param table	The table name of the record.
+     * \param schema	The CREATE TABLE statement of the record.
+     * \param query	The parameterized INSERT statement of the record.
+     * \param read	Captures the values of source.
+     * \param wait	false to drop the record rather than wait for the queue or the connection.
+     */
+    bool submit(const std::string& table, const std::string& schema, const std::string& query, Reader read, const void* source,
+		bool wait=true);
+    ///Writes, queues or spills the record, as the mode says. Second half of submit(). \param start When log() was called.
+    bool deliver(TableInfo* table, Reader read, const void* source, bool wait, std::int64_t start);
+    
+    ///\name Sampling.
+    ///\{
+    ///Applies the sampling of the table, holding the record in its reservoir if chosen. \return true to log it now.
+    bool sample(TableInfo* table, Reader read, const void* source);
+    /**
+     * Writes the records held in the reservoirs whose window is over, or in all of them if force is set, starting their
+     * next window. Called with mtx locked, by the writer in async and spill modes, after each record otherwise.
+     * \return The number of records harvested.
+     */
+    std::size_t harvest(bool force);
+    ///Harvests the reservoirs, then writes the rows of _sqlogger_sampling if the period has elapsed or force is set.
+    ///Called with mtx locked.
+    void reportSampling(bool force=false);
+    ///\}
+    /**
+     * Copies the record into a queue slot, applying the overflow policy. Used by submit() in async mode.
+     * \param more	See Entry::more.
+     * \param wait	false to drop the record if the queue is full, whatever the policy.
+     */
+    bool enqueue(TableInfo* table, Reader read, const void* source, bool more=false, bool wait=true);
+    ///Counts a dropped record. \return false, for the convenience of the callers.
+    bool drop();
+    ///\name Rotation, called with mtx locked.
+    ///\{
+    ///\return The start of the rotation period holding t, 0 without period.
+    std::time_t periodOf(std::time_t t) const;
+    ///\return The strftime() format of the date in the file names, nullptr without period.
+    const char* rotationFormat() const;
+    ///\return Whether name, without directory, is the base file or one rotationName() could have returned.
+    bool isRotationName(const std::string& name) const;
+    ///\return The name of the file of a period, with a sequence number if seq is not 0.
+    std::string rotationName(std::time_t start, std::size_t seq) const;
+    ///Switches to the next file if a limit was reached and no transaction is open.
+    void rotateIfDue();
+    ///Switches to the given file, the pre-opened one if it matches, then pre-opens the next one. On failure the current
+    ///file is kept. It runs on the thread that commits, often the caller of log() in synchronous mode.
+    void rotate(std::time_t start, std::size_t seq);
+    ///Opens the file the next rotation will most likely switch to, unless it is already open.
+    void preopen();
+    ///Closes the pre-opened file, removing it if it was created for nothing.
+    void discardNext();
+    ///\}
+    
+    ///\name Retention, called with mtx locked.
+    ///\{
+    ///Deletes one chunk of expired rows if no transaction is open, starting a new pass over the tables when it is time.
+    void prune();
+    ///Removes the files of this logger, other than the open ones, last modified before cutoff.
+    void dropExpiredFiles(std::time_t cutoff);
+    ///\}
+    ///\name Metrics.
+    ///\{
+    ///\return A steady clock reading in nanoseconds.
+    static std::int64_t ticks();
+    ///Counts rows handed to SQLite, written successfully, their bytes and the time since start. Called with mtx locked.
+    void account(std::size_t rows, std::size_t written, std::size_t bytes, std::int64_t start);
+    ///Writes a row into _sqlogger_stats if the period has elapsed. Called with mtx locked.
+    void reportStats();
+    ///\}
+    ///Writes a row into _sqlogger_overflow if records were dropped since the last one and the period has elapsed.
+    void reportDrops();
+    ///Writes the records a crashed process left in the crash ring, then empties it.
+    void recoverCrashRing();
+    ///Body of the writer thread: drains the queue until the logger is destroyed.
+    void drain();
+    ///Body of the writer thread in synchronous mode with batches: commits each batch by its deadline.
+    void tick();
+    
+    ///\name Spill mode.
+    ///\{
+    /**
+     * Appends the record to the current segment, describing its table first if the segment does not know it yet.
+     * \param wait	false to drop the record rather than create a segment when the current one is full.
+     */
+    bool spillRecord(TableInfo* table, Reader read, const void* source, bool wait);
+    /**
+     * Replaces a full segment with the spare or, if wait is set, a new one, unless another thread already did.
+     * \return The current segment, nullptr if there is none to write into.
+     */
+    SpillSegment* replaceSegment(SpillSegment* full, bool wait);
+    std::string segmentName(std::uint64_t number) const;
+    ///Maps the segments left by a former process, to be ingested before the new ones.
+    void recoverSegments();
+    ///\return A position in the stream of spilled records: segment number, then offset.
+    static std::uint64_t spillPosition(std::uint64_t segment, std::size_t offset) {return segment << 40 | offset;};
+    ///Body of the writer thread in spill mode: ingests the segments until the logger is destroyed.
+    void ingest();
+    ///\}
+    ///Wakes the writer thread up if it is waiting for records.
+    void wake();
     
   private:
     std::string fileName;
     sqlite3* dbHandle;
-    bool created;
+    bool inMemory;
+    Options effective;
+    std::unordered_map<std::string, sqlite3_stmt*> statements;
+    std::mutex mtx;
+    bool multiRow;
+    
+    ///\name Table registry, guarded by tablesMtx so that async producers never wait for the writer.
+    ///\{
+    ///By table name, one entry per INSERT query.
+    std::unordered_multimap<std::string, std::unique_ptr<TableInfo>> tables;
+    std::mutex tablesMtx;
+    ///\}
+    
+    ///\name Group commit state, guarded by mtx.
+    ///\{
+    std::size_t batchSize;
+    std::chrono::milliseconds batchDelay;
+    std::size_t pending;
+    std::chrono::steady_clock::time_point batchStart;
+    ///\}
+    
+    ///\name Async mode. The queue is only allocated when Options::async is set.
+    ///\{
+    std::unique_ptr<RingQueue<Entry>> queue;
+    ///Entries taken from the queue by the writer, and the snapshots of the run being written.
+    std::vector<Entry> taken;
+    std::vector<const Snapshot*> run;
+    ///Blocks of the entries written since the last commit, returned in bulk by commit(). Guarded by mtx.
+    std::vector<Arena::Block> uncommitted;
+    ///Copies of the queued records kept until commit, if Options::crashRing is set, and their tickets.
+    std::unique_ptr<CrashRing> crashRing;
+    std::vector<std::uint64_t> uncommittedKept;
+    std::thread writer;
+    std::atomic<std::size_t> written;
+    std::atomic<std::size_t> committed;
+    std::atomic<int> flushing;
+    std::atomic<bool> sleeping;
+    std::atomic<bool> stopping;
+    std::mutex wakeMtx;
+    std::condition_variable wakeUp;
+    std::condition_variable drained;
+    ///Producers waiting for a slot with OverflowBlock, parked on room until the writer takes entries.
+    std::atomic<int> parked;
+    std::mutex roomMtx;
+    std::condition_variable room;
+    ///\}
+    
+    ///\name Spill mode. The segment lists are guarded by spillMtx.
+    ///\{
+    bool spilling;
+    std::size_t segmentSize;
+    ///Segments not fully ingested yet, oldest first. The last one is spillCurrent.
+    std::deque<std::unique_ptr<SpillSegment>> segments;
+    ///Ingested segments, unmapped, kept until the end for producers still holding a pointer to them.
+    std::vector<std::unique_ptr<SpillSegment>> spent;
+    ///Created ahead by the writer, so that switching segments is quick.
+    std::unique_ptr<SpillSegment> spare;
+    std::atomic<SpillSegment*> spillCurrent;
+    std::uint64_t segmentNumber;
+    std::mutex spillMtx;
+    ///spillPosition() up to which records are committed.
+    std::atomic<std::uint64_t> ingested;
+    ///\}
+    
+    ///\name Rotation state, guarded by mtx.
+    ///\{
+    bool rotating;
+    ///The file given to the constructor, from which the rotated names are built.
+    std::string baseFile;
+    std::time_t period;
+    std::time_t periodEnd;
+    std::size_t sequence;
+    std::int64_t fileRows;
+    std::int64_t pageSize;
+    ///The pre-opened next file, created by preopen() if nextCreated.
+    sqlite3* nextHandle;
+    std::string nextFile;
+    bool nextCreated;
+    ///\}
+    
+    ///\name Retention state, guarded by mtx.
+    ///\{
+    ///Tables left in the current pass, the current one last.
+    std::vector<std::string> pruneTables;
+    std::chrono::steady_clock::time_point pruneNext;
+    ///The cutoff of the current pass, for INTEGER and TEXT timestamps.
+    std::int64_t cutoffNanoseconds;
+    std::string cutoffText;
+    ///\}
+    
+    ///\name Read connections of the threads that called query(), guarded by readers->mtx.
+    ///\{
+    const std::shared_ptr<ReaderSet> readers;
+    ///The file readers open and its number of rotations.
+    std::string readFile;
+    std::size_t generation;
+    ///Set once the database is in the "WAL" journal mode.
+    std::atomic<bool> walReady;
+    ///\}
+    
+    ///\name Metrics. The counters are written with mtx locked or by the writer thread only, but read by stats() at any time.
+    ///\{
+    std::atomic<std::uint64_t> recordCount;
+    std::atomic<std::uint64_t> failedCount;
+    std::atomic<std::uint64_t> commitCount;
+    std::atomic<std::uint64_t> byteCount;
+    std::atomic<std::uint64_t> copiedCount;
+    std::atomic<std::uint64_t> busyCount;
+    std::atomic<std::uint64_t> prepareCount;
+    std::atomic<std::uint64_t> prepareTime;
+    std::atomic<std::size_t> queueHighWater;
+    Histogram logTimes;
+    Histogram writeTimes;
+    Histogram commitTimes;
+    Histogram endToEndTimes;
+    Histogram batchSizes;
+    ///When the records written since the last commit were logged, guarded by mtx.
+    std::vector<std::int64_t> uncommittedSince;
+    std::chrono::steady_clock::time_point lastStats;
+    ///\}
+    
+    ///\name Overflow accounting.
+    ///\{
+    std::atomic<std::size_t> droppedCount;
+    ///Records seen by OverflowSample while the queue was half full.
+    std::atomic<std::size_t> sampled;
+    ///Dropped count and time of the last _sqlogger_overflow row, guarded by mtx.
+    std::size_t reportedDrops;
+    std::chrono::steady_clock::time_point lastReport;
+    ///\}
+    
+    ///\name Sampling, by table name, the time of the last _sqlogger_sampling rows and, in ticks(), the earliest a
+    ///reservoir window may end, guarded by mtx.
+    ///\{
+    const std::unordered_map<std::string, Sampling> samplingConfig;
+    std::chrono::steady_clock::time_point lastSampling;
+    std::int64_t harvestNext;
+    ///\}
   };
   
 }
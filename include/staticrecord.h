@@ -0,0 +1,183 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+
+/**
+ * \file 	staticrecord.h
+ * \author 	Carlos Nihelton <carlosnsoliveira@gmail.com>
+ * \details	It contains the StaticRecord class template, a Record alternative whose schema is fixed at compile time.
+ */
+
+#ifndef STATICRECORD_H
+#define STATICRECORD_H
+
+#include <sqlogger.h>
+
+/**
+ * Declares a name type for StaticRecord table and field names. The SQL name is the identifier itself.
+ * \code SQLOGGER_NAME(USERNAME); \endcode
+ */
+#define SQLOGGER_NAME(Id) struct Id { static const char* name() {return #Id;} }
+
+namespace sqlogger {
+  ///\name 	Storage classes of StaticRecord fields, with the C++ type holding their data.
+  ///\{
+  struct Integer {typedef std::int64_t type; static const char* sql() {return "INTEGER";}};
+  struct Real {typedef double type; static const char* sql() {return "REAL";}};
+  struct Text {typedef std::string type; static const char* sql() {return "TEXT";}};
+  struct Blob {typedef std::vector<char> type; static const char* sql() {return "BLOB";}};
+  ///\}
+  
+  /**
+   * Describes one column of a StaticRecord.
+   * \tparam Name		A type with a static name() member function, see SQLOGGER_NAME.
+   * \tparam Storage	One of Integer, Real, Text or Blob.
+   */
+  template<typename Name, typename Storage>
+  struct Field
+  {
+    typedef Name name;
+    typedef Storage storage;
+    typedef typename Storage::type type;
+  };
+  
+  ///Position of the field named Name among Fields. It does not compile if there is none.
+  template<typename Name, typename... Fields>
+  struct FieldIndex;
+  template<typename Name, typename Storage, typename... Rest>
+  struct FieldIndex<Name, Field<Name, Storage>, Rest...> : std::integral_constant<std::size_t, 0> {};
+  template<typename Name, typename Other, typename... Rest>
+  struct FieldIndex<Name, Other, Rest...> : std::integral_constant<std::size_t, 1+FieldIndex<Name, Rest...>::value> {};
+  
+/**
+ * \class 	sqlogger::StaticRecord
+ * \brief 	A record whose table and columns are template arguments.
+ * \details 	The CREATE and INSERT statements are built once per record type, not per instance,
+ * 		and an instance holds only a tuple with its field values: no field vector, no callbacks, no heap work
+ * 		other than what its strings or blobs need. As with Record, a MOMENT column holding the time of the
+ * 		log call comes first.
+ * \code
+ * SQLOGGER_NAME(hello); SQLOGGER_NAME(USER); SQLOGGER_NAME(MSG);
+ * typedef sqlogger::StaticRecord<hello, sqlogger::Field<USER, sqlogger::Text>, sqlogger::Field<MSG, sqlogger::Text>> Hello;
+ * Hello rec;
+ * rec.get<MSG>() = "Hello, World!";
+ * sqlogger::SQLogger::instance().log(rec);
+ * \endcode
+ */
+  template<typename Table, typename... Fields>
+  class StaticRecord
+  {
+  public:
+    typedef std::tuple<typename Fields::type...> Data;
+    
+    StaticRecord()=default;
+    explicit StaticRecord(const typename Fields::type&... values) : data(values...) {};
+    
+    ///\name 	Access to the field values by position or by name type.
+    ///\{
+    template<std::size_t I>
+    typename std::tuple_element<I, Data>::type& get() {return std::get<I>(data);};
+    template<std::size_t I>
+    const typename std::tuple_element<I, Data>::type& get() const {return std::get<I>(data);};
+    template<typename Name>
+    typename std::tuple_element<FieldIndex<Name, Fields...>::value, Data>::type& get() {return std::get<FieldIndex<Name, Fields...>::value>(data);};
+    template<typename Name>
+    const typename std::tuple_element<FieldIndex<Name, Fields...>::value, Data>::type& get() const {return std::get<FieldIndex<Name, Fields...>::value>(data);};
+    ///\}
+    
+    ///\name 	The statements shared by all the instances of this record type.
+    ///\{
+    static const std::string& getSchema()
+    {
+      static const std::string schema = "CREATE TABLE IF NOT EXISTS " + std::string(Table::name()) + "(MOMENT TEXT" + columns(true) + ')';
+      return schema;
+    }
+    static const std::string& writeQuery()
+    {
+      static const std::string query = "INSERT INTO " + std::string(Table::name()) + " (MOMENT" + columns(false)
+	+ ") VALUES (?" + placeholders() + ')';
+      return query;
+    }
+    ///\}
+    
+    ///Captures the field values, the same way as Record::readValues.
+    void readValues(std::vector<Value>& values) const
+    {
+      values.resize(sizeof...(Fields)+1);
+      Timestamp::now(Timestamp::Seconds, values[0]);
+      store<0>(values);
+    }
+    
+  private:
+    static std::string columns(bool withType)
+    {
+      std::string text;
+      const char* names[] = {Fields::name::name()...};
+      const char* types[] = {Fields::storage::sql()...};
+      for(std::size_t i=0; i<sizeof...(Fields); ++i) {
+	text += ',';
+	text += names[i];
+	if(withType) text += std::string(" ") + types[i];
+      }
+      return text;
+    }
+    
+    static std::string placeholders()
+    {
+      std::string text;
+      for(std::size_t i=0; i<sizeof...(Fields); ++i) text += ",?";
+      return text;
+    }
+    
+    ///\name 	Copy of each tuple element into the Value following MOMENT.
+    ///\{
+    template<std::size_t I>
+    typename std::enable_if<I == sizeof...(Fields)>::type store(std::vector<Value>&) const {};
+    template<std::size_t I>
+    typename std::enable_if<(I < sizeof...(Fields))>::type store(std::vector<Value>& values) const
+    {
+      assign(values[I+1], std::get<I>(data));
+      store<I+1>(values);
+    }
+    static void assign(Value& v, std::int64_t x) {v.setInteger(x);};
+    static void assign(Value& v, double x) {v.setReal(x);};
+    //Text and blobs are viewed in place: the record outlives the log() call.
+    static void assign(Value& v, const std::string& x) {v.setTextView(x.data(), x.size());};
+    static void assign(Value& v, const std::vector<char>& x) {v.setBlobView(x.data(), x.size());};
+    ///\}
+    
+    Data data;
+  };
+  
+  template<typename Table, typename... Fields>
+  bool SQLogger::log(const StaticRecord<Table, Fields...>& rec)
+  {
+    Reader read = [](const void* source, std::vector<Value>& values){
+      static_cast<const StaticRecord<Table, Fields...>*>(source)->readValues(values);
+    };
+    return submit(Table::name(), StaticRecord<Table, Fields...>::getSchema(), StaticRecord<Table, Fields...>::writeQuery(), read, &rec);
+  }
+  
+}
+
+#endif
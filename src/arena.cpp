@@ -0,0 +1,147 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+/**
+ * \file arena.cpp
+ * \author Carlos Nihelton <carlosnsoliveira@gmail.com> (C) 2015
+ * 
+ * It contains definition of the Arena slab allocator.
+ * 
+ */
+
+#include <arena.h>
+#include <mutex>
+#include <vector>
+
+namespace sqlogger{
+  
+  const std::size_t Arena::slabSize;
+  
+  struct Arena::Slab {
+    ///Blocks not returned yet, plus one while the owner thread still allocates from this slab.
+    std::atomic<std::size_t> live;
+    std::size_t used;
+    char data[slabSize];
+  };
+  
+  namespace {
+    //Free slabs shared by all the threads. Never destroyed: writer threads of static loggers may return slabs at exit.
+    struct Pool {
+      std::mutex mtx;
+      std::vector<void*> slabs;
+      static const std::size_t capacity = 64;
+    };
+    Pool& pool()
+    {
+      static Pool* thePool = new Pool;
+      return *thePool;
+    }
+    
+    std::atomic<std::size_t> inUse(0);
+    std::atomic<std::size_t> highWater(0);
+    std::atomic<std::size_t> fallbacks(0);
+    
+    thread_local Arena threadArena;
+  }
+  
+  Arena::~Arena()
+  {
+    if(current) unref(current, 1);
+  }
+  
+  Arena::Block Arena::allocate(std::size_t size)
+  {
+    //8 byte granularity keeps the blocks aligned for whoever reads them.
+    size = (size + 7) & ~static_cast<std::size_t>(7);
+    if(size > slabSize/4) {
+      fallbacks.fetch_add(1, std::memory_order_relaxed);
+      return Block{new char[size], nullptr};
+    }
+    
+    Slab*& slab = threadArena.current;
+    if(!slab || slab->used + size > slabSize) {
+      if(slab) unref(slab, 1);
+      slab = nullptr;
+      {
+	Pool& p = pool();
+	std::lock_guard<std::mutex> lock(p.mtx);
+	if(!p.slabs.empty()) {
+	  slab = static_cast<Slab*>(p.slabs.back());
+	  p.slabs.pop_back();
+	}
+      }
+      if(!slab) slab = new Slab;
+      slab->live.store(1, std::memory_order_relaxed);
+      slab->used = 0;
+      
+      std::size_t bytes = inUse.fetch_add(slabSize, std::memory_order_relaxed) + slabSize;
+      std::size_t peak = highWater.load(std::memory_order_relaxed);
+      while(bytes > peak && !highWater.compare_exchange_weak(peak, bytes, std::memory_order_relaxed));
+    }
+    
+    Block block{slab->data + slab->used, slab};
+    slab->used += size;
+    slab->live.fetch_add(1, std::memory_order_relaxed);
+    return block;
+  }
+  
+  void Arena::release(const Block* blocks, std::size_t n) noexcept
+  {
+    for(std::size_t i=0; i<n; ) {
+      if(!blocks[i].slab) {
+	delete[] blocks[i++].data;
+	continue;
+      }
+      std::size_t j=i+1;
+      while(j<n && blocks[j].slab == blocks[i].slab) ++j;
+      unref(static_cast<Slab*>(blocks[i].slab), j-i);
+      i = j;
+    }
+  }
+  
+  void Arena::unref(Slab* slab, std::size_t count) noexcept
+  {
+    if(slab->live.fetch_sub(count, std::memory_order_acq_rel) != count) return;
+    
+    inUse.fetch_sub(slabSize, std::memory_order_relaxed);
+    Pool& p = pool();
+    {
+      std::lock_guard<std::mutex> lock(p.mtx);
+      if(p.slabs.size() < Pool::capacity) {
+	try {
+	  p.slabs.push_back(slab);
+	  return;
+	} catch(...) {
+	}
+      }
+    }
+    delete slab;
+  }
+  
+  Arena::Stats Arena::getStats() noexcept
+  {
+    return Stats{inUse.load(std::memory_order_relaxed), highWater.load(std::memory_order_relaxed),
+      fallbacks.load(std::memory_order_relaxed)};
+  }
+  
+}
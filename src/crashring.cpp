@@ -0,0 +1,221 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+/**
+ * \file crashring.cpp
+ * \author Carlos Nihelton <carlosnsoliveira@gmail.com> (C) 2015
+ * 
+ * It contains definition of the CrashRing class.
+ * 
+ */
+
+#include <crashring.h>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace sqlogger{
+  
+  namespace {
+    //The header holds the magic, the geometry and the bytes used in the table area.
+    const char magic[8] = {'S', 'Q', 'L', 'R', 'I', 'N', 'G', '1'};
+    const std::size_t header = 64;
+    const std::size_t tableArea = 64*1024;
+    const std::size_t slotHeader = 16;
+    //Slot states: empty, being written, or the ticket shifted left with the low bit set once released.
+    const std::uint64_t empty = 0;
+    const std::uint64_t busy = 1;
+    
+    static_assert(sizeof(std::atomic<std::uint64_t>) == sizeof(std::uint64_t), "slot states are atomics laid on the mapping");
+    static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "table lengths are atomics laid on the mapping");
+    
+    std::atomic<std::uint64_t>* state(char* p) {return reinterpret_cast<std::atomic<std::uint64_t>*>(p);}
+    std::atomic<std::uint32_t>* word(char* p) {return reinterpret_cast<std::atomic<std::uint32_t>*>(p);}
+    std::size_t padded(std::size_t n) {return (n + 7) & ~static_cast<std::size_t>(7);}
+  }
+  
+  const std::size_t CrashRing::first = header + tableArea;
+  
+  CrashRing::CrashRing(const std::string& file, std::size_t slots, std::size_t slotSize) : file(file),
+    wantedSlots(std::max<std::size_t>(slots, 1)), wantedSlotSize(padded(std::max(slotSize, 2*slotHeader))), slots(0), slotSize(0),
+    length(0), base(nullptr), sequence(1)
+  {
+    int fd = ::open(file.c_str(), O_RDWR);
+    struct stat info;
+    std::uint64_t geometry[2] = {0, 0};
+    if(fd >= 0 && fstat(fd, &info) == 0 && static_cast<std::size_t>(info.st_size) >= first) {
+      char head[sizeof(magic) + sizeof(geometry)];
+      if(pread(fd, head, sizeof(head), 0) == static_cast<ssize_t>(sizeof(head)) && std::memcmp(head, magic, sizeof(magic)) == 0) {
+	std::memcpy(geometry, head + sizeof(magic), sizeof(geometry));
+	if(geometry[0] == 0 || geometry[1] < 2*slotHeader || geometry[1] % 8 != 0
+	  || static_cast<std::size_t>(info.st_size) != first + geometry[0]*geometry[1]) geometry[0] = 0;
+      }
+    }
+    if(fd >= 0 && geometry[0] != 0) {
+      //A ring left by a former process: mapped as it is, for recovery.
+      this->slots = static_cast<std::size_t>(geometry[0]);
+      this->slotSize = static_cast<std::size_t>(geometry[1]);
+      length = static_cast<std::size_t>(info.st_size);
+      void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if(p == MAP_FAILED) throw std::runtime_error("Cannot map crash ring " + file);
+      base = static_cast<char*>(p);
+      return;
+    }
+    if(fd >= 0) ::close(fd);
+    create();
+  }
+  
+  CrashRing::~CrashRing()
+  {
+    if(base) munmap(base, length);
+  }
+  
+  void CrashRing::create()
+  {
+    if(base) munmap(base, length);
+    base = nullptr;
+    slots = wantedSlots;
+    slotSize = wantedSlotSize;
+    length = first + slots*slotSize;
+    
+    //Truncated first, so that every slot reads back empty.
+    int fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) throw std::runtime_error("Cannot create crash ring " + file);
+    if(ftruncate(fd, static_cast<off_t>(length)) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Cannot allocate crash ring " + file);
+    }
+    void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED) throw std::runtime_error("Cannot map crash ring " + file);
+    base = static_cast<char*>(p);
+    
+    const std::uint64_t geometry[2] = {slots, slotSize};
+    std::memcpy(base + sizeof(magic), geometry, sizeof(geometry));
+    std::memcpy(base, magic, sizeof(magic));
+  }
+  
+  void CrashRing::reset()
+  {
+    create();
+    sequence = 1;
+  }
+  
+  bool CrashRing::describe(std::uint32_t id, const std::string& name, const std::string& schema, const std::string& query) noexcept
+  {
+    //An entry is its length, its id and the three strings, each prefixed by its length. The length is set last.
+    const std::size_t size = 8 + 12 + name.size() + schema.size() + query.size();
+    std::atomic<std::uint64_t>* used = state(base + sizeof(magic) + 16);
+    const std::size_t pos = static_cast<std::size_t>(used->fetch_add(padded(size), std::memory_order_relaxed));
+    if(pos + size > tableArea) return false;
+    
+    char* entry = base + header + pos;
+    std::memcpy(entry + 4, &id, 4);
+    char* p = entry + 8;
+    for(const std::string* s : {&name, &schema, &query}) {
+      const std::uint32_t n = static_cast<std::uint32_t>(s->size());
+      std::memcpy(p, &n, 4);
+      std::memcpy(p + 4, s->data(), n);
+      p += 4 + n;
+    }
+    word(entry)->store(static_cast<std::uint32_t>(size), std::memory_order_release);
+    return true;
+  }
+  
+  std::uint64_t CrashRing::keep(std::uint32_t table, const char* data, std::size_t size) noexcept
+  {
+    if(size > slotSize - slotHeader) return 0;
+    const std::uint64_t ticket = sequence.fetch_add(1, std::memory_order_relaxed);
+    char* s = slot(ticket);
+    //A thread a whole lap behind may still be writing the slot: this record is then not kept.
+    std::uint64_t previous = state(s)->load(std::memory_order_relaxed);
+    if(previous == busy || !state(s)->compare_exchange_strong(previous, busy, std::memory_order_acquire)) return 0;
+    const std::uint32_t n = static_cast<std::uint32_t>(size);
+    std::memcpy(s + 8, &table, 4);
+    std::memcpy(s + 12, &n, 4);
+    std::memcpy(s + slotHeader, data, size);
+    state(s)->store(ticket << 1, std::memory_order_release);
+    return ticket;
+  }
+  
+  void CrashRing::release(std::uint64_t ticket) noexcept
+  {
+    std::uint64_t kept = ticket << 1;
+    state(slot(ticket))->compare_exchange_strong(kept, kept | 1, std::memory_order_relaxed);
+  }
+  
+  std::vector<CrashRing::Table> CrashRing::tables() const
+  {
+    std::vector<Table> found;
+    for(std::size_t pos = 0; pos + 8 <= tableArea; ) {
+      char* entry = base + header + pos;
+      const std::uint32_t size = word(entry)->load(std::memory_order_acquire);
+      //Either the end, or an entry torn by the crash: what follows cannot be trusted.
+      if(size < 20 || pos + size > tableArea) break;
+      Table t;
+      std::memcpy(&t.id, entry + 4, 4);
+      std::size_t at = 8;
+      for(std::string* s : {&t.name, &t.schema, &t.query}) {
+	std::uint32_t n = 0;
+	if(at + 4 <= size) std::memcpy(&n, entry + at, 4);
+	if(at + 4 + n > size) break;
+	s->assign(entry + at + 4, n);
+	at += 4 + n;
+      }
+      if(!t.schema.empty()) found.push_back(t);
+      pos += padded(size);
+    }
+    return found;
+  }
+  
+  std::vector<CrashRing::Kept> CrashRing::pending() const
+  {
+    std::vector<std::pair<std::uint64_t, Kept>> kept;
+    for(std::size_t i=0; i<slots; ++i) {
+      char* s = base + first + i*slotSize;
+      const std::uint64_t st = state(s)->load(std::memory_order_acquire);
+      if(st == empty || st == busy || (st & 1) != 0) continue;
+      Kept k;
+      std::uint32_t n;
+      std::memcpy(&k.table, s + 8, 4);
+      std::memcpy(&n, s + 12, 4);
+      if(n > slotSize - slotHeader) continue;
+      k.data = s + slotHeader;
+      k.size = n;
+      kept.emplace_back(st >> 1, k);
+    }
+    std::sort(kept.begin(), kept.end(), [](const std::pair<std::uint64_t, Kept>& a, const std::pair<std::uint64_t, Kept>& b){
+      return a.first < b.first;
+    });
+    std::vector<Kept> records;
+    records.reserve(kept.size());
+    for(const auto& k : kept) records.push_back(k.second);
+    return records;
+  }
+  
+}
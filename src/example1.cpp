@@ -36,7 +36,7 @@ using namespace sqlogger;
 
 class LogRec : public Record
 {
-//Encapsulated data.These member values will be put into the database using its getters, which must supply string return values.  
+//Encapsulated data.These member values will be put into the database using its getters.
 private:
   std::string m_user;
   std::thread::id m_threadId;
@@ -46,10 +46,12 @@ public:
   LogRec();
   ~LogRec()=default;
   
-  //getters: Note that they must return const std::string and take no parameters.
-  const std::string userName(){return m_user;};
-  const std::string Msg(){return m_message;};
-  const std::string threadId();  
+  //getters: Note that they must take no parameters and return a string, an integer, a floating point number,
+  //a TextRef or a BlobRef. Numbers are stored as such, no need to convert them into strings.
+  //A TextRef views the member in place, saving the copy a returned string would cost.
+  TextRef userName(){return TextRef{m_user.data(), m_user.size()};};
+  TextRef Msg(){return TextRef{m_message.data(), m_message.size()};};
+  std::size_t threadId();  
   
   //setter to allow passing messages to this object on the fly.
   void setMsg(const std::string& msg){m_message = msg;};
@@ -65,16 +67,14 @@ LogRec::LogRec()
   setTableName("LogRecExample");
   //field mapping.
   addField("USERNAME", "TEXT", std::bind(&LogRec::userName, this));
-  addField("THREAD_ID", "TEXT", std::bind(&LogRec::threadId, this));
+  addField("THREAD_ID", "INTEGER", std::bind(&LogRec::threadId, this));
   addField("MESSAGE", "TEXT", std::bind(&LogRec::Msg, this));
 }
 
-//Returning this thread id as string.
-const std::string LogRec::threadId()
+//Returning this thread id as a number.
+std::size_t LogRec::threadId()
 {
-  std::ostringstream oss;
-  oss << std::this_thread::get_id();
-  return oss.str();
+  return std::hash<std::thread::id>()(m_threadId);
 }
 
 //Main Function - Demonstrates this logger capabilities inside a multithread environment.
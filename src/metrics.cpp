@@ -0,0 +1,105 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+/**
+ * \file metrics.cpp
+ * \author Carlos Nihelton <carlosnsoliveira@gmail.com> (C) 2015
+ * 
+ * It contains definition of the Histogram class.
+ * 
+ */
+
+#include <metrics.h>
+#include <vector>
+
+namespace sqlogger{
+  
+  std::size_t detail::threadNumber() noexcept
+  {
+    static std::atomic<std::size_t> next(0);
+    static thread_local const std::size_t number = next.fetch_add(1, std::memory_order_relaxed);
+    return number;
+  }
+  
+  const std::size_t Histogram::buckets;
+  
+  Histogram::Histogram(std::size_t stripes) : stripes(stripes > 0 ? stripes : 1), data(new Stripe[this->stripes])
+  {
+    for(std::size_t s=0; s<this->stripes; ++s) {
+      for(auto& c : data[s].counts) c.store(0, std::memory_order_relaxed);
+      data[s].sum.store(0, std::memory_order_relaxed);
+    }
+  }
+  
+  std::size_t Histogram::bucketOf(std::uint64_t value) noexcept
+  {
+    if(value < 8) return static_cast<std::size_t>(value);
+    int magnitude = 63;
+    while(!(value >> magnitude)) --magnitude;
+    return static_cast<std::size_t>(magnitude-2)*8 + ((value >> (magnitude-3)) & 7);
+  }
+  
+  std::uint64_t Histogram::valueOf(std::size_t bucket) noexcept
+  {
+    if(bucket < 8) return bucket;
+    const int shift = static_cast<int>(bucket/8) - 1;
+    const std::uint64_t lowest = static_cast<std::uint64_t>(8 + bucket%8) << shift;
+    return lowest + (static_cast<std::uint64_t>(1) << shift)/2;
+  }
+  
+  void Histogram::record(std::uint64_t value) noexcept
+  {
+    Stripe& s = data[stripes == 1 ? 0 : detail::threadNumber() % stripes];
+    s.counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+    s.sum.fetch_add(value, std::memory_order_relaxed);
+  }
+  
+  Histogram::Summary Histogram::summary() const
+  {
+    std::vector<std::uint64_t> counts(buckets, 0);
+    std::uint64_t total = 0, sum = 0;
+    for(std::size_t s=0; s<stripes; ++s) {
+      for(std::size_t b=0; b<buckets; ++b) {
+	const std::uint64_t c = data[s].counts[b].load(std::memory_order_relaxed);
+	counts[b] += c;
+	total += c;
+      }
+      sum += data[s].sum.load(std::memory_order_relaxed);
+    }
+    
+    Summary summary{total, total ? static_cast<double>(sum)/total : 0.0, 0, 0, 0, 0};
+    if(total == 0) return summary;
+    const double fractions[] = {0.50, 0.99, 0.999};
+    std::uint64_t* targets[] = {&summary.p50, &summary.p99, &summary.p999};
+    std::uint64_t seen = 0;
+    std::size_t next = 0;
+    for(std::size_t b=0; b<buckets; ++b) {
+      if(!counts[b]) continue;
+      seen += counts[b];
+      while(next < 3 && seen >= fractions[next]*total) *targets[next++] = valueOf(b);
+      summary.max = valueOf(b);
+    }
+    return summary;
+  }
+  
+}
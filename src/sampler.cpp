@@ -0,0 +1,165 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+/**
+ * \file sampler.cpp
+ * \author Carlos Nihelton <carlosnsoliveira@gmail.com> (C) 2015
+ * 
+ * It contains definition of the Sampler class.
+ * 
+ */
+
+#include <sampler.h>
+#include <metrics.h>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <thread>
+
+namespace sqlogger{
+  
+  namespace {
+    ///xorshift64*, seeded per thread: a few nanoseconds and no shared state.
+    std::uint64_t random() noexcept
+    {
+      static thread_local std::uint64_t state = (std::hash<std::thread::id>()(std::this_thread::get_id()) | 1) * 0x9E3779B97F4A7C15ull;
+      state ^= state >> 12;
+      state ^= state << 25;
+      state ^= state >> 27;
+      return state * 0x2545F4914F6CDD1Dull;
+    }
+  }
+  
+  const std::size_t Sampler::stripes;
+  
+  Sampler::Sampler(const Sampling& config) : reportedSeen(0), reportedKept(0), config(config), threshold(0), interval(0),
+    tolerance(0), arrival(0), window(0), windowEnd(0), harvested(0)
+  {
+    if(config.ratio >= 1) threshold = ~static_cast<std::uint64_t>(0);
+    else if(config.ratio > 0) threshold = static_cast<std::uint64_t>(std::ldexp(config.ratio, 64));
+    interval = config.rate > 0 ? static_cast<std::int64_t>(1e9/config.rate) : std::numeric_limits<std::int64_t>::max()/4;
+    tolerance = static_cast<std::int64_t>(std::max(config.burst - 1, 0.0)*interval);
+    arrival = now();
+    windowEnd = now() + std::chrono::duration_cast<std::chrono::nanoseconds>(config.window).count();
+    for(auto& c : counts) {
+      c.seen = 0;
+      c.kept = 0;
+    }
+  }
+  
+  std::int64_t Sampler::now() noexcept
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+  
+  Sampler::Verdict Sampler::admit(std::uint64_t& slot) noexcept
+  {
+    Counts& c = counts[detail::threadNumber() % stripes];
+    c.seen.fetch_add(1, std::memory_order_relaxed);
+    switch(config.mode) {
+      case Sampling::SampleAll:
+	break;
+      case Sampling::SampleRatio:
+	if(threshold != ~static_cast<std::uint64_t>(0) && random() >= threshold) return Drop;
+	break;
+      case Sampling::SampleRate: {
+	const std::int64_t t = now();
+	std::int64_t due = arrival.load(std::memory_order_relaxed);
+	for(;;) {
+	  const std::int64_t from = std::max(due, t);
+	  if(from - t > tolerance) return Drop;
+	  if(arrival.compare_exchange_weak(due, from + interval, std::memory_order_relaxed)) break;
+	}
+	break;
+      }
+      case Sampling::SampleReservoir: {
+	//Algorithm R: the i-th record of the window replaces a random one of the reservoir with probability k/i.
+	const std::uint64_t w = window.fetch_add(1, std::memory_order_relaxed);
+	const std::uint64_t i = (w & 0xffffffffull) + 1;
+	const std::uint64_t k = config.reservoir;
+	if(k == 0) return Drop;
+	if(i <= k) slot = i - 1;
+	else {
+	  const std::uint64_t j = random() % i;
+	  if(j >= k) return Drop;
+	  slot = j;
+	}
+	slot |= w & ~0xffffffffull;
+	return Hold;
+      }
+    }
+    c.kept.fetch_add(1, std::memory_order_relaxed);
+    return Keep;
+  }
+  
+  void Sampler::hold(std::uint64_t slot, std::string&& record)
+  {
+    std::lock_guard<std::mutex> lock(heldMtx);
+    //The window only changes under heldMtx: a record admitted in one already harvested is late.
+    if((slot ^ window.load(std::memory_order_relaxed)) & ~0xffffffffull) return;
+    const std::size_t i = static_cast<std::size_t>(slot & 0xffffffffull);
+    if(held.size() <= i) held.resize(i + 1);
+    held[i] = std::move(record);
+  }
+  
+  bool Sampler::due() const noexcept
+  {
+    return now() >= windowEnd.load(std::memory_order_relaxed);
+  }
+  
+  std::int64_t Sampler::end() const noexcept
+  {
+    return windowEnd.load(std::memory_order_relaxed);
+  }
+  
+  std::vector<std::string> Sampler::harvest(bool force)
+  {
+    std::vector<std::string> records;
+    std::lock_guard<std::mutex> lock(heldMtx);
+    const std::int64_t t = now();
+    if(!force && t < windowEnd.load(std::memory_order_relaxed)) return records;
+    windowEnd = t + std::chrono::duration_cast<std::chrono::nanoseconds>(config.window).count();
+    window.store((window.load(std::memory_order_relaxed) & ~0xffffffffull) + (1ull << 32), std::memory_order_relaxed);
+    records.swap(held);
+    //A slot admitted but not filled yet is empty.
+    records.erase(std::remove_if(records.begin(), records.end(), [](const std::string& r){ return r.empty(); }), records.end());
+    harvested.fetch_add(records.size(), std::memory_order_relaxed);
+    return records;
+  }
+  
+  std::uint64_t Sampler::seen() const noexcept
+  {
+    std::uint64_t n = 0;
+    for(const auto& c : counts) n += c.seen.load(std::memory_order_relaxed);
+    return n;
+  }
+  
+  std::uint64_t Sampler::kept() const noexcept
+  {
+    std::uint64_t n = harvested.load(std::memory_order_relaxed);
+    for(const auto& c : counts) n += c.kept.load(std::memory_order_relaxed);
+    return n;
+  }
+  
+}
@@ -0,0 +1,148 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+/**
+ * \file shardedlogger.cpp
+ * \author Carlos Nihelton <carlosnsoliveira@gmail.com> (C) 2015
+ * 
+ * It contains definition of the ShardedLogger class.
+ * 
+ */
+
+#include <shardedlogger.h>
+#include <set>
+#include <map>
+
+namespace sqlogger{
+  
+  namespace {
+    //Runs a statement, throwing on errors. Rows, if any, are passed to the callback.
+    void exec(sqlite3* db, const std::string& sql, std::function<void(sqlite3_stmt*)> row=nullptr)
+    {
+      sqlite3_stmt* stmt;
+      if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+	throw std::runtime_error(sqlite3_errmsg(db));
+      }
+      int error;
+      while((error = sqlite3_step(stmt)) == SQLITE_ROW) {
+	if(row) row(stmt);
+      }
+      sqlite3_finalize(stmt);
+      if(error != SQLITE_DONE) throw std::runtime_error(sqlite3_errmsg(db));
+    }
+    
+    std::string text(sqlite3_stmt* stmt, int column)
+    {
+      const unsigned char* t = sqlite3_column_text(stmt, column);
+      return t ? reinterpret_cast<const char*>(t) : "";
+    }
+    
+    //Single quotes a string for use as an SQL literal.
+    std::string quote(const std::string& s)
+    {
+      std::string quoted{'\''};
+      for(char c : s) {
+	quoted += c;
+	if(c == '\'') quoted += c;
+      }
+      return quoted + '\'';
+    }
+  }
+  
+  ShardedLogger::ShardedLogger(const std::string& file, std::size_t count, const Options& options)
+  {
+    if(count == 0) throw std::invalid_argument("ShardedLogger -> at least one shard is needed");
+    
+    std::size_t dot = file.find_last_of('.');
+    if(dot == std::string::npos || file.find('/', dot) != std::string::npos) dot = file.size();
+    for(std::size_t i=0; i<count; ++i) {
+      files.push_back(file.substr(0, dot) + '.' + std::to_string(i) + file.substr(dot));
+      shards.emplace_back(new SQLogger(files.back(), options));
+    }
+  }
+  
+  void ShardedLogger::flush()
+  {
+    for(auto& s : shards) s->flush();
+  }
+  
+  void ShardedLogger::attach(sqlite3* db) const
+  {
+    //Table name -> schemas of the shards having it.
+    std::map<std::string, std::vector<std::string>> tables;
+    for(std::size_t i=0; i<files.size(); ++i) {
+      const std::string schema = "shard" + std::to_string(i);
+      exec(db, "ATTACH DATABASE " + quote(files[i]) + " AS " + schema);
+      exec(db, "SELECT name FROM " + schema + ".sqlite_master WHERE type='table'", [&](sqlite3_stmt* stmt){
+	tables[text(stmt, 0)].push_back(schema);
+      });
+    }
+    
+    for(const auto& t : tables) {
+      std::string view = "CREATE TEMP VIEW IF NOT EXISTS \"" + t.first + "\" AS ";
+      for(const auto& schema : t.second) {
+	view += "SELECT * FROM " + schema + ".\"" + t.first + "\" UNION ALL ";
+      }
+      view.resize(view.size() - std::string(" UNION ALL ").size());
+      exec(db, view);
+    }
+  }
+  
+  void ShardedLogger::merge(const std::string& file)
+  {
+    flush();
+    
+    sqlite3* db;
+    if(sqlite3_open(file.c_str(), &db) != SQLITE_OK) {
+      std::string error = sqlite3_errmsg(db);
+      sqlite3_close(db);
+      throw std::runtime_error(error);
+    }
+    
+    try {
+      std::set<std::string> existing;
+      exec(db, "SELECT name FROM sqlite_master WHERE type='table'", [&](sqlite3_stmt* stmt){ existing.insert(text(stmt, 0)); });
+      
+      for(const auto& f : files) {
+	exec(db, "ATTACH DATABASE " + quote(f) + " AS shard");
+	exec(db, "BEGIN");
+	std::vector<std::pair<std::string, std::string>> tables;
+	exec(db, "SELECT name, sql FROM shard.sqlite_master WHERE type='table'", [&](sqlite3_stmt* stmt){
+	  tables.emplace_back(text(stmt, 0), text(stmt, 1));
+	});
+	for(const auto& t : tables) {
+	  //The stored CREATE TABLE keeps the declared column types.
+	  if(existing.insert(t.first).second) exec(db, t.second);
+	  exec(db, "INSERT INTO main.\"" + t.first + "\" SELECT * FROM shard.\"" + t.first + '"');
+	}
+	exec(db, "COMMIT");
+	exec(db, "DETACH DATABASE shard");
+      }
+    } catch(...) {
+      sqlite3_close(db);
+      throw;
+    }
+    sqlite3_close(db);
+  }
+  
+}
@@ -0,0 +1,183 @@
+/***************************************************************************
+ *   (C) Carlos Nihelton (carlosnsoliveira@gmail.com) 2015                 *
+ *                                                                         *
+ *   This file is part of SQLogger C++11 data logger facility.             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU Library General Public License (LGPL)   *
+ *   as published by the Free Software Foundation; either version 2 of     *
+ *   the License, or (at your option) any later version.                   *
+ *   for detail see the LICENCE text file.                                 *
+ *                                                                         *
+ *   SQLogger is distributed in the hope that it will be useful,           *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU Library General Public License for more details.                  *
+ *                                                                         *
+ *   You should have received a copy of the GNU Library General Public     *
+ *   License along with this code; if not, write to the Free Software      *
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  *
+ *   USA                                                                   *
+ *                                                                         *
+ *   Carlos Nihelton 2015                                                  *
+ ***************************************************************************/
+/**
+ * \file spill.cpp
+ * \author Carlos Nihelton <carlosnsoliveira@gmail.com> (C) 2015
+ * 
+ * It contains definition of the SpillSegment class.
+ * 
+ */
+
+#include <spill.h>
+#include <cstring>
+#include <cstdio>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace sqlogger{
+  
+  namespace {
+    const char magic[8] = {'S', 'Q', 'L', 'S', 'P', 'I', 'L', '1'};
+    ///The file starts with the magic and the checkpoint, the offset up to which records were ingested.
+    const std::size_t first = sizeof(magic) + 8;
+    const std::size_t header = 8;
+    const std::uint32_t ready = 1;
+    
+    static_assert(sizeof(std::atomic<std::uint32_t>) == sizeof(std::uint32_t), "record states are atomics laid on the mapping");
+    
+    std::atomic<std::uint32_t>* field(char* p) {return reinterpret_cast<std::atomic<std::uint32_t>*>(p);}
+    std::size_t padded(std::size_t n) {return (n + 7) & ~static_cast<std::size_t>(7);}
+  }
+  
+  SpillSegment::SpillSegment(const std::string& file, std::uint64_t number, std::size_t capacity) : file(file), rank(number),
+    size(padded(capacity < 2*first ? 2*first : capacity)), base(nullptr), tail(first), active(0), sealed(false),
+    readPos(first), saved(0)
+  {
+    int fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) throw std::runtime_error("Cannot create spill segment " + file);
+    //A real allocation, not a sparse file, so that appending never fails for lack of disk space.
+    if(posix_fallocate(fd, 0, static_cast<off_t>(size)) != 0 && ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      ::close(fd);
+      std::remove(file.c_str());
+      throw std::runtime_error("Cannot allocate spill segment " + file);
+    }
+    map(fd);
+    std::memcpy(base, magic, sizeof(magic));
+    checkpoint();
+  }
+  
+  SpillSegment::SpillSegment(const std::string& file, std::uint64_t number) : file(file), rank(number), size(0), base(nullptr),
+    tail(0), active(0), sealed(true), readPos(first), saved(0)
+  {
+    int fd = ::open(file.c_str(), O_RDWR);
+    struct stat info;
+    if(fd < 0 || fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < first) {
+      if(fd >= 0) ::close(fd);
+      throw std::runtime_error("Cannot open spill segment " + file);
+    }
+    size = static_cast<std::size_t>(info.st_size);
+    map(fd);
+    if(std::memcmp(base, magic, sizeof(magic)) != 0) {
+      munmap(base, size);
+      base = nullptr;
+      throw std::runtime_error(file + " is not a spill segment");
+    }
+    tail = size;
+    std::uint64_t done;
+    std::memcpy(&done, base + sizeof(magic), sizeof(done));
+    if(done > first && done <= size) saved = static_cast<std::size_t>(done);
+  }
+  
+  void SpillSegment::map(int fd)
+  {
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED) throw std::runtime_error("Cannot map spill segment " + file);
+    base = static_cast<char*>(p);
+  }
+  
+  SpillSegment::~SpillSegment()
+  {
+    if(base) munmap(base, size);
+  }
+  
+  char* SpillSegment::reserve(std::size_t n) noexcept
+  {
+    const std::size_t room = header + padded(n);
+    const std::size_t pos = tail.fetch_add(room, std::memory_order_seq_cst);
+    //Once one reservation overflows, every later one does: the records end at the first empty header.
+    //seal() pushes the tail past the end, so reservations that still fit were made before it and are kept.
+    if(pos + room > size) return nullptr;
+    char* record = base + pos;
+    field(record)->store(static_cast<std::uint32_t>(n), std::memory_order_relaxed);
+    return record + header;
+  }
+  
+  void SpillSegment::publish(char* record) noexcept
+  {
+    field(record - header + 4)->store(ready, std::memory_order_release);
+  }
+  
+  void SpillSegment::seal() noexcept
+  {
+    sealed.store(true, std::memory_order_seq_cst);
+    tail.fetch_add(size, std::memory_order_seq_cst);
+  }
+  
+  bool SpillSegment::quiescent() const noexcept
+  {
+    return sealed.load(std::memory_order_seq_cst) && active.load(std::memory_order_acquire) == 0;
+  }
+  
+  std::size_t SpillSegment::reserved() const noexcept
+  {
+    const std::size_t t = tail.load(std::memory_order_acquire);
+    return t < size ? t : size;
+  }
+  
+  std::size_t SpillSegment::maxRecord(std::size_t capacity) noexcept
+  {
+    return capacity - first - header;
+  }
+  
+  SpillSegment::Status SpillSegment::next(const char*& data, std::size_t& n) noexcept
+  {
+    if(!base || readPos + header > size) return End;
+    char* record = base + readPos;
+    std::uint32_t state = field(record + 4)->load(std::memory_order_acquire);
+    if(state != ready) {
+      if(!quiescent()) return Pending;
+      //The producer may have published it right before leaving.
+      state = field(record + 4)->load(std::memory_order_acquire);
+    }
+    const std::uint32_t length = field(record)->load(std::memory_order_relaxed);
+    if(state != ready) {
+      if(length == 0) return End;
+      readPos += header + padded(length);
+      return Torn;
+    }
+    if(readPos + header + padded(length) > size) return End;
+    data = record + header;
+    n = length;
+    readPos += header + padded(length);
+    return Ready;
+  }
+  
+  void SpillSegment::checkpoint() noexcept
+  {
+    const std::uint64_t done = readPos;
+    if(base) std::memcpy(base + sizeof(magic), &done, sizeof(done));
+  }
+  
+  void SpillSegment::discard() noexcept
+  {
+    if(base) munmap(base, size);
+    base = nullptr;
+    std::remove(file.c_str());
+  }
+  
+}
@@ -30,76 +30,1868 @@
  */
 
 #include <sqlogger.h>
-#include <iostream>
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+#include <limits>
+#include <dirent.h>
+#include <sys/stat.h>
 
 namespace sqlogger{
   
-  SQLogger::SQLogger(const std::string& file) : created(false)
+  namespace {
+    bool exists(const std::string& file)
+    {
+      std::FILE* f = std::fopen(file.c_str(), "rb");
+      if(f) std::fclose(f);
+      return f != nullptr;
+    }
+    
+    ///\return The position of the extension of a file name, its size if there is none.
+    std::size_t extension(const std::string& file)
+    {
+      const std::size_t slash = file.find_last_of("/\\");
+      const std::size_t dot = file.rfind('.');
+      return dot == std::string::npos || (slash != std::string::npos && dot < slash) ? file.size() : dot;
+    }
+    
+    ///\return The text and blob bytes copied to capture the values: those held by copy and, for a snapshot, all of them.
+    std::size_t copiedBytes(const std::vector<Value>& values, bool snapshot) noexcept
+    {
+      std::size_t n = 0;
+      for(const auto& v : values) {
+	if(v.getType() != Value::Text && v.getType() != Value::Blob) continue;
+	n += (v.isView() ? 0 : v.size()) + (snapshot ? v.size() : 0);
+      }
+      return n;
+    }
+  }
+  
+  const std::size_t SQLogger::rowBlocks[3] = {128, 32, 8};
+
+  SQLogger::TableInfo::TableInfo(const std::string& name, const std::string& schema, const std::string& query, std::uint32_t id) :
+    name(name), schema(schema), query(query),
+    columns(std::count(query.begin(), query.end(), '?')), insert(nullptr), insertRows(), created(false), id(id), spilledIn(~static_cast<std::uint64_t>(0))
   {
-    if(sqlite3_open(file.c_str(), &dbHandle) == SQLITE_OK)  {
-      fileName = file;
+  }
+
+  std::string SQLogger::TableInfo::rowsQuery(std::size_t rows) const
+  {
+    //The last parenthesis of the single row INSERT holds the placeholders of one row.
+    const std::size_t values = query.rfind('(');
+    const std::string row = query.substr(values);
+    std::string text = query;
+    text.reserve(query.size() + (rows-1)*(row.size()+1));
+    for(std::size_t i=1; i<rows; ++i) text += ',' + row;
+    return text;
+  }
+
+  SQLogger::SQLogger(const std::string& file, const Options& options) : multiRow(options.multiRowInsert), batchSize(options.batchSize),
+    batchDelay(options.batchDelay), pending(0), written(0), committed(0), flushing(0), sleeping(false), stopping(false), parked(0),
+    spilling(false), segmentSize(options.spillSegmentSize), spillCurrent(nullptr), segmentNumber(0), ingested(0),
+    baseFile(file), period(0), periodEnd(0), sequence(0), fileRows(0), pageSize(0), nextHandle(nullptr), nextCreated(false),
+    cutoffNanoseconds(0), readers(std::make_shared<ReaderSet>()), generation(0), walReady(false), recordCount(0), failedCount(0), commitCount(0), byteCount(0), copiedCount(0), busyCount(0), prepareCount(0),
+    prepareTime(0), queueHighWater(0), logTimes(16), lastStats(std::chrono::steady_clock::now()), droppedCount(0), sampled(0), reportedDrops(0), lastReport(std::chrono::steady_clock::now()),
+    samplingConfig(options.sampling), lastSampling(std::chrono::steady_clock::now()), harvestNext(0)
+  {
+    dbHandle = nullptr;
+    inMemory = file.empty() || file == ":memory:" || file.compare(0, 13, "file::memory:") == 0;
+    rotating = !inMemory && (options.rotateSize > 0 || options.rotateRows > 0 || options.rotatePeriod.count() > 0);
+    fileName = file;
+    if(rotating) {
+      effective.rotatePeriod = options.rotatePeriod;
+      period = periodOf(std::time(nullptr));
+      periodEnd = options.rotatePeriod.count() > 0 ? periodOf(period + options.rotatePeriod.count()) : 0;
+      while(exists(rotationName(period, sequence+1))) ++sequence;
+      fileName = rotationName(period, sequence);
     }
-    else {
-      throw std::runtime_error(sqlite3_errmsg(dbHandle));
+    dbHandle = open(fileName, options);
+    
+    //The destructor does not run if the constructor throws: what was opened so far is closed here.
+    try {
+      const char* path = sqlite3_db_filename(dbHandle, "main");
+      readFile = path ? path : "";
+      inMemory = inMemory || readFile.empty();
+      if(rotating) {
+	pageSize = std::stoll(pragma("PRAGMA page_size"));
+	preopen();
+      }
+      
+      if(!options.crashRing.empty()) {
+	crashRing.reset(new CrashRing(options.crashRing, options.crashRingSlots, options.crashRingSlotSize));
+	recoverCrashRing();
+      }
+      
+      if(options.spill && !inMemory) {
+	//Spill mode replaces the queue: records go to the segments, the writer thread ingests them.
+	spilling = true;
+	recoverSegments();
+	segments.emplace_back(new SpillSegment(segmentName(segmentNumber), segmentNumber, segmentSize));
+	++segmentNumber;
+	spillCurrent = segments.back().get();
+	run.reserve(rowBlocks[0]);
+	writer = std::thread(&SQLogger::ingest, this);
+      }
+      else if(options.async) {
+	queue.reset(new RingQueue<Entry>(options.queueCapacity));
+	taken.resize(rowBlocks[0]);
+	writer = std::thread(&SQLogger::drain, this);
+      }
+      else if(batchSize > 1) writer = std::thread(&SQLogger::tick, this);
+    } catch(...) {
+      close();
+      throw;
     }
   }
   
   SQLogger::~SQLogger()
   {
+    if(writer.joinable()) {
+      //The writer only leaves once the queue is empty, or every segment is ingested.
+      if(spilling) {
+	std::lock_guard<std::mutex> lock(spillMtx);
+	spillCurrent.load()->seal();
+      }
+      stopping = true;
+      wake();
+      writer.join();
+      if(spare) spare->discard();
+    }
+    rotating = false;
+    //The last records held in the reservoirs too.
+    reportSampling(true);
+    settle();
+    close();
+  }
+
+  void SQLogger::close()
+  {
+    discardNext();
+    auto finalize = [](TableInfo& t){
+      sqlite3_finalize(t.insert);
+      for(auto stmt : t.insertRows) sqlite3_finalize(stmt);
+    };
+    for(auto& t : tables) finalize(*t.second);
+    for(auto& s : statements) sqlite3_finalize(s.second);
+    {
+      std::lock_guard<std::mutex> lock(readers->mtx);
+      readers->connections.clear();
+    }
     sqlite3_close(dbHandle);
   }
 
+  sqlite3* SQLogger::open(const std::string& file, const Options& options)
+  {
+    sqlite3* db = nullptr;
+    if(sqlite3_open(file.c_str(), &db) != SQLITE_OK) {
+      std::string error = sqlite3_errmsg(db);
+      sqlite3_close(db);
+      throw std::runtime_error(error);
+    }
+    
+    sqlite3_busy_handler(db, &SQLogger::busy, this);
+    
+    //configure() works on dbHandle, which is lent to the new connection meanwhile.
+    sqlite3* current = dbHandle;
+    dbHandle = db;
+    try {
+      configure(options);
+    } catch(...) {
+      dbHandle = current;
+      sqlite3_close(db);
+      throw;
+    }
+    dbHandle = current;
+    return db;
+  }
+
+  void SQLogger::configure(const Options& options)
+  {
+    static const char* synchronousNames[] = {"OFF", "NORMAL", "FULL", "EXTRA"};
+    
+    //Only takes effect before the first table is created.
+    if(options.retention.count() > 0) pragma("PRAGMA auto_vacuum=INCREMENTAL");
+    if(!options.journalMode.empty()) pragma("PRAGMA journal_mode=" + options.journalMode);
+    if(options.synchronous != Options::SyncDefault) pragma(std::string("PRAGMA synchronous=") + synchronousNames[options.synchronous]);
+    if(options.cacheSize != 0) pragma("PRAGMA cache_size=" + std::to_string(options.cacheSize));
+    if(options.mmapSize >= 0) pragma("PRAGMA mmap_size=" + std::to_string(options.mmapSize));
+    if(options.tempStore != Options::TempDefault) pragma("PRAGMA temp_store=" + std::to_string(static_cast<int>(options.tempStore)));
+    if(options.walAutocheckpoint >= 0) pragma("PRAGMA wal_autocheckpoint=" + std::to_string(options.walAutocheckpoint));
+    
+    //Some settings may be silently refused, e.g. WAL on an in-memory database, so report what SQLite says.
+    effective = options;
+    effective.journalMode = pragma("PRAGMA journal_mode");
+    effective.synchronous = static_cast<Options::Synchronous>(std::stoi(pragma("PRAGMA synchronous")));
+    effective.cacheSize = std::stoll(pragma("PRAGMA cache_size"));
+    std::string mmap = pragma("PRAGMA mmap_size");
+    effective.mmapSize = mmap.empty() ? 0 : std::stoll(mmap);
+    effective.tempStore = static_cast<Options::TempStore>(std::stoi(pragma("PRAGMA temp_store")));
+    effective.walAutocheckpoint = std::stoi(pragma("PRAGMA wal_autocheckpoint"));
+  }
+
+  std::string SQLogger::pragma(const std::string& statement)
+  {
+    sqlite3_stmt* stmt;
+    std::string result;
+    if(sqlite3_prepare_v2(dbHandle, statement.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+      throw std::runtime_error(sqlite3_errmsg(dbHandle));
+    }
+    int error = sqlite3_step(stmt);
+    if(error == SQLITE_ROW) {
+      const unsigned char* text = sqlite3_column_text(stmt, 0);
+      if(text) result = reinterpret_cast<const char*>(text);
+    }
+    sqlite3_finalize(stmt);
+    if(error != SQLITE_ROW && error != SQLITE_DONE) throw std::runtime_error(sqlite3_errmsg(dbHandle));
+    return result;
+  }
+
+  sqlite3_stmt* SQLogger::statement(const std::string& query)
+  {
+    auto it = statements.find(query);
+    if(it != statements.end()) return it->second;
+    
+    sqlite3_stmt* stmt = nullptr;
+    if(compile(query, &stmt) != SQLITE_OK) {
+      sqlite3_finalize(stmt);
+      return nullptr;
+    }
+    statements.emplace(query, stmt);
+    return stmt;
+  }
+
+  int SQLogger::compile(const std::string& sql, sqlite3_stmt** stmt)
+  {
+    const std::int64_t start = ticks();
+    int error = sqlite3_prepare_v2(dbHandle, sql.c_str(), -1, stmt, nullptr);
+    prepareCount.fetch_add(1, std::memory_order_relaxed);
+    prepareTime.fetch_add(ticks() - start, std::memory_order_relaxed);
+    return error;
+  }
+
+  int SQLogger::busy(void* self, int count)
+  {
+    SQLogger* logger = static_cast<SQLogger*>(self);
+    //Sleeps 1, 2, 4, 8, then 10 ms at a time, while the total stays within the timeout.
+    int slept = 0;
+    for(int i=0; i<count; ++i) slept += std::min(1 << std::min(i, 4), 10);
+    const int next = std::min(1 << std::min(count, 4), 10);
+    if(slept + next > logger->effective.busyTimeout.count()) return 0;
+    logger->busyCount.fetch_add(1, std::memory_order_relaxed);
+    sqlite3_sleep(next);
+    return 1;
+  }
+
+  SQLogger::ReadConnection& SQLogger::readConnection()
+  {
+    std::lock_guard<std::mutex> lock(readers->mtx);
+    std::unique_ptr<ReadConnection>& r = readers->connections[std::this_thread::get_id()];
+    //The log file was rotated since this connection was opened.
+    if(r && r->generation != generation) r.reset();
+    if(!r) {
+      sqlite3* db = nullptr;
+      //The connection is only used by this thread, so SQLite's own mutexes are not needed.
+      if(sqlite3_open_v2(readFile.c_str(), &db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr) != SQLITE_OK) {
+	std::string error = sqlite3_errmsg(db);
+	sqlite3_close(db);
+	readers->connections.erase(std::this_thread::get_id());
+	throw std::runtime_error(error);
+      }
+      sqlite3_busy_timeout(db, 1000);
+      r.reset(new ReadConnection(db, generation));
+      
+      std::vector<std::weak_ptr<ReaderSet>>& owned = threadReaders();
+      owned.erase(std::remove_if(owned.begin(), owned.end(), [](const std::weak_ptr<ReaderSet>& w){ return w.expired(); }), owned.end());
+      if(std::none_of(owned.begin(), owned.end(), [this](const std::weak_ptr<ReaderSet>& w){ return w.lock() == readers; })) {
+	owned.push_back(readers);
+      }
+    }
+    return *r;
+  }
+
+  std::vector<std::weak_ptr<SQLogger::ReaderSet>>& SQLogger::threadReaders()
+  {
+    //Per-request threads would otherwise leave a connection behind each, until the logger is destroyed.
+    struct Owner {
+      std::vector<std::weak_ptr<ReaderSet>> sets;
+      ~Owner() {
+	for(const auto& w : sets) {
+	  if(std::shared_ptr<ReaderSet> set = w.lock()) {
+	    std::lock_guard<std::mutex> lock(set->mtx);
+	    set->connections.erase(std::this_thread::get_id());
+	  }
+	}
+      }
+    };
+    static thread_local Owner owner;
+    return owner.sets;
+  }
+
+  SQLogger::ReadConnection::~ReadConnection()
+  {
+    for(auto& s : statements) sqlite3_finalize(s.second);
+    sqlite3_close(db);
+  }
+
+  const std::size_t SQLogger::ReadConnection::maxStatements;
+
+  sqlite3_stmt* SQLogger::ReadConnection::statement(const std::string& sql)
+  {
+    const auto known = positions.find(sql);
+    if(known != positions.end()) {
+      statements.splice(statements.begin(), statements, known->second);
+      return known->second->second;
+    }
+    
+    sqlite3_stmt* stmt = nullptr;
+    if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+      sqlite3_finalize(stmt);
+      throw std::runtime_error(sqlite3_errmsg(db));
+    }
+    statements.emplace_front(sql, stmt);
+    positions[sql] = statements.begin();
+    //A statement still being stepped, by a query() nested in a row handler, is kept.
+    Statements::iterator it = std::prev(statements.end());
+    while(statements.size() > maxStatements && it != statements.begin()) {
+      const Statements::iterator victim = it--;
+      if(sqlite3_stmt_busy(victim->second)) continue;
+      sqlite3_finalize(victim->second);
+      positions.erase(victim->first);
+      statements.erase(victim);
+    }
+    return stmt;
+  }
+
+  std::size_t SQLogger::query(const std::string& sql, const std::vector<Value>& params, const RowHandler& row)
+  {
+    if(inMemory) {
+      std::lock_guard<std::mutex> lock(mtx);
+      sqlite3_stmt* stmt = statement(sql);
+      if(!stmt) throw std::runtime_error(sqlite3_errmsg(dbHandle));
+      //The writer's connection would run anything.
+      if(!sqlite3_stmt_readonly(stmt)) throw std::runtime_error("query() only runs read-only statements: " + sql);
+      return fetch(dbHandle, stmt, params, row);
+    }
+    
+    if(!walReady.load(std::memory_order_acquire)) enableWal();
+    //Only this thread uses its connection, no lock is held while the query runs.
+    ReadConnection& r = readConnection();
+    sqlite3_stmt* stmt = r.statement(sql);
+    if(!sqlite3_stmt_readonly(stmt)) throw std::runtime_error("query() only runs read-only statements: " + sql);
+    return fetch(r.db, stmt, params, row);
+  }
+
+  void SQLogger::enableWal()
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if(effective.journalMode != "wal") {
+      //The journal mode cannot change within a transaction.
+      settle();
+      effective.journalMode = pragma("PRAGMA journal_mode=WAL");
+      if(effective.journalMode != "wal") {
+	throw std::runtime_error("query() needs the WAL journal mode, the database is in " + effective.journalMode);
+      }
+      //Rotated files get the same mode, the pre-opened one is opened again.
+      discardNext();
+      if(rotating) preopen();
+    }
+    walReady.store(true, std::memory_order_release);
+  }
+
+  std::size_t SQLogger::fetch(sqlite3* db, sqlite3_stmt* stmt, const std::vector<Value>& params, const RowHandler& row)
+  {
+    struct Reset {
+      sqlite3_stmt* stmt;
+      ~Reset() {sqlite3_reset(stmt); sqlite3_clear_bindings(stmt);}
+    } reset{stmt};
+    
+    if(!bind(stmt, params)) throw std::runtime_error(sqlite3_errmsg(db));
+    std::vector<Value> values(sqlite3_column_count(stmt));
+    std::size_t rows = 0;
+    int error;
+    while((error = sqlite3_step(stmt)) == SQLITE_ROW) {
+      for(std::size_t i=0; i<values.size(); ++i) {
+	const int column = static_cast<int>(i);
+	switch(sqlite3_column_type(stmt, column)) {
+	  case SQLITE_INTEGER:
+	    values[i].setInteger(sqlite3_column_int64(stmt, column));
+	    break;
+	  case SQLITE_FLOAT:
+	    values[i].setReal(sqlite3_column_double(stmt, column));
+	    break;
+	  case SQLITE_TEXT:
+	    values[i].setText(reinterpret_cast<const char*>(sqlite3_column_text(stmt, column)), sqlite3_column_bytes(stmt, column));
+	    break;
+	  case SQLITE_BLOB:
+	    values[i].setBlob(sqlite3_column_blob(stmt, column), sqlite3_column_bytes(stmt, column));
+	    break;
+	  default:
+	    values[i].setNull();
+	}
+      }
+      ++rows;
+      row(values);
+    }
+    if(error != SQLITE_DONE) throw std::runtime_error(sqlite3_errmsg(db));
+    return rows;
+  }
 
   //bool SQLogger::log(const std::unique_ptr<Record> rec)
   bool SQLogger::log(Record* rec)
   {
-    sqlite3_stmt* stmt;
-    bool logged{false};
-    int error=SQLITE_OK;
+    return submit(rec->getTableName(), rec->getSchema(), rec->writeQuery(), &SQLogger::readRecord, rec);
+  }
+
+  bool SQLogger::tryLog(Record* rec)
+  {
+    return submit(rec->getTableName(), rec->getSchema(), rec->writeQuery(), &SQLogger::readRecord, rec, false);
+  }
+
+  std::vector<bool> SQLogger::log(const std::vector<Record*>& recs)
+  {
+    const std::size_t n = recs.size();
+    std::vector<bool> logged(n, false);
+    std::vector<TableInfo*> targets(n, nullptr);
+    std::size_t last = n;
+    {
+      std::lock_guard<std::mutex> lock(tablesMtx);
+      for(std::size_t i=0; i<n; ++i) {
+	if(recs[i]->getSchema().empty()) continue;
+	targets[i] = find(recs[i]->getTableName(), recs[i]->getSchema(), recs[i]->writeQuery());
+      }
+    }
+    for(std::size_t i=0; i<n; ++i) {
+      if(targets[i] && targets[i]->sampler && !sample(targets[i], &SQLogger::readRecord, recs[i])) {
+	targets[i] = nullptr;
+	logged[i] = true;
+      }
+      if(targets[i]) last = i;
+    }
+    if(last == n) return logged;
     
-    if(!created){
-      std::string schema=rec->getSchema();
-      if(!schema.empty()) {
-	error = sqlite3_prepare_v2(dbHandle, schema.c_str(), -1, &stmt, nullptr);
-	if(error == SQLITE_OK) {
-	  error = sqlite3_step(stmt);
-	  if(error == SQLITE_OK || error == SQLITE_DONE) created = true;
+    const std::int64_t start = ticks();
+    if(queue) {
+      for(std::size_t i=0; i<=last; ++i) {
+	if(targets[i]) logged[i] = enqueue(targets[i], &SQLogger::readRecord, recs[i], i < last);
+      }
+      logTimes.record(ticks() - start);
+      return logged;
+    }
+    if(spilling) {
+      for(std::size_t i=0; i<=last; ++i) {
+	if(targets[i]) logged[i] = spillRecord(targets[i], &SQLogger::readRecord, recs[i], true);
+      }
+      logTimes.record(ticks() - start);
+      return logged;
+    }
+    
+    //Field callbacks run before taking the lock. Each thread reuses its own buffers.
+    static thread_local std::vector<std::vector<Value>> values;
+    if(values.size() < n) values.resize(n);
+    for(std::size_t i=0; i<=last; ++i) {
+      if(targets[i]) readRecord(recs[i], values[i]);
+    }
+    
+    //Consecutive records of the same table are written together.
+    std::vector<const std::vector<Value>*> rows;
+    std::unique_ptr<bool[]> flags(new bool[n]);
+    std::lock_guard<std::mutex> lock(mtx);
+    begin(true);
+    for(std::size_t i=0; i<=last; ) {
+      if(!targets[i]) {
+	++i;
+	continue;
+      }
+      std::size_t j=i;
+      std::size_t bytes = 0;
+      rows.clear();
+      while(j<=last && targets[j] == targets[i]) {
+	bytes += Snapshot::measure(values[j]);
+	copiedCount.fetch_add(copiedBytes(values[j], false), std::memory_order_relaxed);
+	rows.push_back(&values[j++]);
+      }
+      const std::int64_t began = ticks();
+      write(*targets[i], rows.data(), rows.size(), &flags[i]);
+      std::size_t written = 0;
+      for(; i<j; ++i) {
+	logged[i] = flags[i];
+	if(flags[i]) {
+	  ++written;
+	  uncommittedSince.push_back(start);
 	}
-	sqlite3_finalize(stmt);
       }
+      account(rows.size(), written, bytes, began);
+    }
+    //Records left in a transaction a reader keeps open are still committed later; only a rollback loses them.
+    if((batchSize <= 1 || batchDue()) && !commit() && sqlite3_get_autocommit(dbHandle)) logged.assign(n, false);
+    logTimes.record(ticks() - start);
+    return logged;
+  }
+
+  void SQLogger::readRecord(const void* source, std::vector<Value>& values)
+  {
+    const_cast<Record*>(static_cast<const Record*>(source))->readValues(values);
+  }
+
+  bool SQLogger::submit(const std::string& table, const std::string& schema, const std::string& query, Reader read, const void* source,
+		       bool wait)
+  {
+    if(schema.empty()) return false;
+    const std::int64_t start = ticks();
+    TableInfo* t = lookup(table, schema, query);
+    if(t->sampler && !sample(t, read, source)) return true;
+    return deliver(t, read, source, wait, start);
+  }
+
+  bool SQLogger::deliver(TableInfo* t, Reader read, const void* source, bool wait, std::int64_t start)
+  {
+    if(queue) {
+      bool queued = enqueue(t, read, source, false, wait);
+      logTimes.record(ticks() - start);
+      return queued;
+    }
+    if(spilling) {
+      bool spilled = spillRecord(t, read, source, wait);
+      logTimes.record(ticks() - start);
+      return spilled;
+    }
+    
+    //Field callbacks run before taking the lock. Each thread reuses its own buffers.
+    static thread_local std::vector<Value> values;
+    read(source, values);
+    std::unique_lock<std::mutex> lock(mtx, std::defer_lock);
+    if(wait) lock.lock();
+    else if(!lock.try_lock()) return drop();
+    const std::int64_t began = ticks();
+    bool logged = write(*t, values);
+    account(1, logged ? 1 : 0, Snapshot::measure(values), began);
+    copiedCount.fetch_add(copiedBytes(values, false), std::memory_order_relaxed);
+    if(logged) uncommittedSince.push_back(start);
+    reportDrops();
+    reportSampling();
+    reportStats();
+    if(batchDue()) commit();
+    logTimes.record(ticks() - start);
+    return logged;
+  }
+
+  bool SQLogger::sample(TableInfo* table, Reader read, const void* source)
+  {
+    Sampler& sampler = *table->sampler;
+    std::uint64_t slot = 0;
+    switch(sampler.admit(slot)) {
+      case Sampler::Keep:
+	return true;
+      case Sampler::Drop:
+	return false;
+      case Sampler::Hold:
+	break;
+    }
+    //The record may be replaced before the window ends, so it is read now and kept encoded.
+    static thread_local std::vector<Value> values;
+    read(source, values);
+    std::string record(Snapshot::measure(values), '\0');
+    Snapshot::encode(values, &record[0]);
+    sampler.hold(slot, std::move(record));
+    
+    //Without a writer to harvest the reservoir, the thread that finds the window over does it.
+    if(!queue && !spilling && sampler.due()) {
+      std::lock_guard<std::mutex> lock(mtx);
+      harvest(false);
+    }
+    return false;
+  }
+
+  std::size_t SQLogger::harvest(bool force)
+  {
+    const std::int64_t now = ticks();
+    if(!force && now < harvestNext) return 0;
+    
+    //A table created later starts its window now, so it cannot end before the shortest window has passed.
+    harvestNext = std::numeric_limits<std::int64_t>::max();
+    for(const auto& config : samplingConfig) {
+      if(config.second.mode != Sampling::SampleReservoir) continue;
+      harvestNext = std::min(harvestNext, now + std::chrono::duration_cast<std::chrono::nanoseconds>(config.second.window).count());
+    }
+    std::vector<TableInfo*> sampled;
+    {
+      std::lock_guard<std::mutex> lock(tablesMtx);
+      for(const auto& t : tables) {
+	if(t.second->sampler && t.second->sampler->getConfig().mode == Sampling::SampleReservoir) sampled.push_back(t.second.get());
+      }
+    }
+    std::size_t harvested = 0;
+    for(TableInfo* table : sampled) {
+      for(const std::string& record : table->sampler->harvest(force)) {
+	const std::int64_t began = ticks();
+	const bool logged = write(*table, Snapshot(record.data(), record.size()));
+	account(1, logged ? 1 : 0, record.size(), began);
+	if(logged) uncommittedSince.push_back(began);
+	++harvested;
+      }
+      harvestNext = std::min(harvestNext, table->sampler->end());
     }
+    return harvested;
+  }
+
+  void SQLogger::reportSampling(bool force)
+  {
+    static const char* modeNames[] = {"all", "ratio", "reservoir", "rate"};
     
-    std::string query=rec->writeQuery();
-    if(!query.empty() && created) {
-      error = sqlite3_prepare_v2(dbHandle, query.c_str(), -1, &stmt, nullptr);
+    if(samplingConfig.empty()) return;
+    harvest(force);
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(!force && (effective.samplingReport.count() <= 0 || now - lastSampling < effective.samplingReport)) return;
+    lastSampling = now;
+    
+    std::vector<TableInfo*> sampled;
+    {
+      std::lock_guard<std::mutex> lock(tablesMtx);
+      for(const auto& t : tables) {
+	if(t.second->sampler) sampled.push_back(t.second.get());
+      }
+    }
+    TableInfo* t = lookup("_sqlogger_sampling", "CREATE TABLE IF NOT EXISTS _sqlogger_sampling(MOMENT TEXT, TABLE_NAME TEXT, MODE TEXT, SEEN INTEGER, KEPT INTEGER)",
+			  "INSERT INTO _sqlogger_sampling (MOMENT, TABLE_NAME, MODE, SEEN, KEPT) VALUES (?, ?, ?, ?, ?)");
+    std::vector<Value> values(5);
+    Timestamp::now(Timestamp::Seconds, values[0]);
+    for(TableInfo* table : sampled) {
+      Sampler& sampler = *table->sampler;
+      const std::uint64_t seen = sampler.seen();
+      const std::uint64_t kept = sampler.kept();
+      if(seen == sampler.reportedSeen && kept == sampler.reportedKept) continue;
+      const char* mode = modeNames[sampler.getConfig().mode];
+      values[1].setTextView(table->name.data(), table->name.size());
+      values[2].setTextView(mode, std::strlen(mode));
+      values[3].setInteger(static_cast<std::int64_t>(seen - sampler.reportedSeen));
+      values[4].setInteger(static_cast<std::int64_t>(kept - sampler.reportedKept));
+      if(write(*t, values)) {
+	sampler.reportedSeen = seen;
+	sampler.reportedKept = kept;
+      }
+    }
+  }
+
+  SQLogger::TableInfo* SQLogger::lookup(const std::string& name, const std::string& schema, const std::string& query)
+  {
+    std::lock_guard<std::mutex> lock(tablesMtx);
+    return find(name, schema, query);
+  }
+
+  SQLogger::TableInfo* SQLogger::find(const std::string& name, const std::string& schema, const std::string& query)
+  {
+    const auto known = tables.equal_range(name);
+    for(auto it = known.first; it != known.second; ++it) {
+      if(it->second->query == query) return it->second.get();
+    }
+    std::unique_ptr<TableInfo> t(new TableInfo(name, schema, query, static_cast<std::uint32_t>(tables.size() + 1)));
+    const auto sampling = samplingConfig.find(name);
+    if(sampling != samplingConfig.end()) t->sampler.reset(new Sampler(sampling->second));
+    if(crashRing) crashRing->describe(t->id, name, schema, query);
+    return tables.emplace(name, std::move(t))->second.get();
+  }
+
+  bool SQLogger::prepare(TableInfo& table)
+  {
+    if(!table.created) {
+      sqlite3_stmt* stmt;
+      int error = compile(table.schema, &stmt);
       if(error == SQLITE_OK) {
 	error = sqlite3_step(stmt);
-	if(error == SQLITE_OK || error == SQLITE_DONE) logged = true;
+	if(error == SQLITE_OK || error == SQLITE_DONE) table.created = true;
       }
       sqlite3_finalize(stmt);
+      if(!table.created) return false;
+    }
+    
+    if(!table.insert && compile(table.query, &table.insert) != SQLITE_OK) {
+      sqlite3_finalize(table.insert);
+      table.insert = nullptr;
+      return false;
+    }
+    return true;
+  }
+
+  bool SQLogger::step(sqlite3_stmt* stmt)
+  {
+    int error = sqlite3_step(stmt);
+    //Statement stays with the table, ready for the next record.
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    return error == SQLITE_OK || error == SQLITE_DONE;
+  }
+
+  template<typename Row>
+  bool SQLogger::write(TableInfo& table, const Row& row)
+  {
+    begin();
+    if(!prepare(table)) return false;
+    
+    bool logged = bind(table.insert, row) && step(table.insert);
+    if(!logged) {
+      sqlite3_reset(table.insert);
+      sqlite3_clear_bindings(table.insert);
+    }
+    if(logged) {
+      ++pending;
+      ++fileRows;
     }
     return logged;
   }
 
+  template<typename Row>
+  void SQLogger::write(TableInfo& table, const Row* const* rows, std::size_t n, bool* logged)
+  {
+    begin();
+    std::size_t i=0;
+    if(multiRow && n >= rowBlocks[2] && prepare(table)) {
+      const int limit = sqlite3_limit(dbHandle, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+      for(std::size_t b=0; b<3; ++b) {
+	const std::size_t block = rowBlocks[b];
+	if(block*table.columns > static_cast<std::size_t>(limit)) continue;
+	
+	while(n-i >= block) {
+	  sqlite3_stmt*& stmt = table.insertRows[b];
+	  if(!stmt && compile(table.rowsQuery(block), &stmt) != SQLITE_OK) {
+	    sqlite3_finalize(stmt);
+	    stmt = nullptr;
+	    break;
+	  }
+	  
+	  bool ok = true;
+	  for(std::size_t r=0; r<block && ok; ++r) ok = bind(stmt, *rows[i+r], 1+r*table.columns);
+	  ok = ok ? step(stmt) : (sqlite3_reset(stmt), sqlite3_clear_bindings(stmt), false);
+	  for(std::size_t r=0; r<block; ++r, ++i) {
+	    bool row = ok || write(table, *rows[i]);
+	    if(logged) logged[i] = row;
+	  }
+	  if(ok) {
+	    pending += block;
+	    fileRows += block;
+	  }
+	}
+      }
+    }
+    for(; i<n; ++i) {
+      bool row = write(table, *rows[i]);
+      if(logged) logged[i] = row;
+    }
+  }
+
+  void SQLogger::begin(bool always)
+  {
+    if((always || batchSize > 1) && sqlite3_get_autocommit(dbHandle)) {
+      sqlite3_stmt* stmt = statement("BEGIN");
+      if(stmt && sqlite3_step(stmt) == SQLITE_DONE) {
+	pending = 0;
+	batchStart = std::chrono::steady_clock::now();
+      }
+      if(stmt) sqlite3_reset(stmt);
+    }
+  }
+
+  bool SQLogger::commit(bool force)
+  {
+    bool done = true;
+    if(!sqlite3_get_autocommit(dbHandle)) {
+      const std::int64_t start = ticks();
+      sqlite3_stmt* stmt = statement("COMMIT");
+      const int result = stmt ? sqlite3_step(stmt) : SQLITE_ERROR;
+      if(stmt) sqlite3_reset(stmt);
+      commitTimes.record(ticks() - start);
+      //A reader holds the database: the transaction stays open and its records are committed by a later call.
+      if(!force && ((result & 0xff) == SQLITE_BUSY || (result & 0xff) == SQLITE_LOCKED)) return false;
+      if(result != SQLITE_DONE) {
+	//Any other failure leaves the transaction open too; give its records up rather than wedging every later batch.
+	sqlite3_exec(dbHandle, "ROLLBACK", nullptr, nullptr, nullptr);
+	done = false;
+      }
+      pending = 0;
+    }
+    if(!uncommittedSince.empty()) {
+      const std::int64_t now = ticks();
+      if(done) {
+	for(std::int64_t since : uncommittedSince) endToEndTimes.record(now - since);
+	batchSizes.record(uncommittedSince.size());
+	commitCount.fetch_add(1, std::memory_order_relaxed);
+      } else {
+	failedCount.fetch_add(uncommittedSince.size(), std::memory_order_relaxed);
+      }
+      uncommittedSince.clear();
+    }
+    committed.store(written.load(std::memory_order_relaxed), std::memory_order_release);
+    //Committed or rolled back, the snapshots are not needed anymore.
+    Arena::release(uncommitted.data(), uncommitted.size());
+    uncommitted.clear();
+    for(std::uint64_t ticket : uncommittedKept) crashRing->release(ticket);
+    uncommittedKept.clear();
+    rotateIfDue();
+    prune();
+    return done;
+  }
+
+  bool SQLogger::settle()
+  {
+    for(int i=0; i<300; ++i) {
+      const bool done = commit();
+      if(done || sqlite3_get_autocommit(dbHandle)) return done;
+      sqlite3_sleep(10);
+    }
+    return commit(true);
+  }
+
+  bool SQLogger::batchDue() const
+  {
+    //Without batching a transaction is only open for a bulk log call, closed by its last record or by the delay.
+    return sqlite3_get_autocommit(dbHandle) || (batchSize > 1 && pending >= batchSize)
+      || std::chrono::steady_clock::now() - batchStart >= batchDelay;
+  }
+
+  bool SQLogger::enqueue(TableInfo* table, Reader read, const void* source, bool more, bool wait)
+  {
+    const Options::Overflow policy = wait ? effective.overflow : Options::OverflowDropNewest;
+    if(policy == Options::OverflowSample && queue->size() > queue->capacity()/2
+      && sampled.fetch_add(1, std::memory_order_relaxed) % std::max<std::size_t>(effective.sampleRate, 1) != 0) {
+      return drop();
+    }
+    
+    std::size_t ticket;
+    Entry* slot;
+    std::chrono::steady_clock::time_point deadline;
+    bool waiting = false;
+    while((slot = queue->tryClaim(ticket)) == nullptr) {
+      if(policy == Options::OverflowDropOldest) {
+	//Taken entries are out of the ring, so this works even while the writer is stuck in a write.
+	Entry oldest;
+	if(queue->take(&oldest, 1)) {
+	  Arena::release(&oldest.block, 1);
+	  if(oldest.kept) crashRing->release(oldest.kept);
+	  written.fetch_add(1, std::memory_order_relaxed);
+	  drop();
+	}
+	continue;
+      }
+      if(policy != Options::OverflowBlock) return drop();
+      const bool bounded = effective.overflowTimeout.count() >= 0;
+      if(!waiting) {
+	deadline = std::chrono::steady_clock::now() + effective.overflowTimeout;
+	waiting = true;
+	wake();
+      }
+      else if(bounded && std::chrono::steady_clock::now() >= deadline) return drop();
+      
+      //Parks until drain() takes entries. Pairs with the fence there: either it sees us parked or we see the room.
+      parked.fetch_add(1, std::memory_order_seq_cst);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      {
+	std::unique_lock<std::mutex> lock(roomMtx);
+	if(queue->size() >= queue->capacity()) {
+	  if(bounded) room.wait_until(lock, deadline);
+	  else room.wait(lock);
+	}
+      }
+      parked.fetch_sub(1, std::memory_order_relaxed);
+    }
+    
+    try {
+      //Field callbacks run here, then the values are copied once into the slot.
+      static thread_local std::vector<Value> values;
+      read(source, values);
+      slot->block = Arena::allocate(Snapshot::measure(values));
+      slot->snapshot = Snapshot::encode(values, slot->block.data);
+      slot->table = table;
+      slot->more = more;
+      slot->since = ticks();
+      slot->kept = crashRing ? crashRing->keep(table->id, slot->snapshot.data(), slot->snapshot.size()) : 0;
+      slot->copied = copiedBytes(values, true);
+    } catch(...) {
+      //The slot is published anyway so the writer does not stall on it, but it will be skipped.
+      slot->table = nullptr;
+      slot->block = Arena::Block{nullptr, nullptr};
+      slot->more = false;
+      slot->kept = 0;
+      slot->copied = 0;
+      queue->publish(ticket);
+      throw;
+    }
+    queue->publish(ticket);
+    
+    //Pairs with the fence in drain(): either the writer sees this slot or we see it sleeping.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleeping.load(std::memory_order_relaxed)) wake();
+    return true;
+  }
+
+  std::string SQLogger::getFileName()
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    return fileName;
+  }
+
+  std::time_t SQLogger::periodOf(std::time_t t) const
+  {
+    const std::time_t length = static_cast<std::time_t>(effective.rotatePeriod.count());
+    if(length <= 0) return 0;
+    if(86400 % length != 0) return t - t % length;
+    std::tm local;
+    localtime_r(&t, &local);
+    return t - (local.tm_hour*3600 + local.tm_min*60 + local.tm_sec) % length;
+  }
+
+  const char* SQLogger::rotationFormat() const
+  {
+    const std::int64_t length = effective.rotatePeriod.count();
+    if(length <= 0) return nullptr;
+    //The name is as precise as the period needs. No colons, for the sake of other file systems.
+    return length % 86400 == 0 ? "%Y-%m-%d" : length % 3600 == 0 ? "%Y-%m-%dT%H"
+      : length % 60 == 0 ? "%Y-%m-%dT%H-%M" : "%Y-%m-%dT%H-%M-%S";
+  }
+
+  bool SQLogger::isRotationName(const std::string& name) const
+  {
+    const std::size_t slash = baseFile.find_last_of('/');
+    const std::size_t from = slash == std::string::npos ? 0 : slash+1;
+    const std::size_t dot = extension(baseFile);
+    const std::string stem = baseFile.substr(from, dot-from);
+    const std::string ext = baseFile.substr(dot);
+    if(name == stem + ext) return true;
+    if(name.size() < stem.size()+ext.size() || name.compare(0, stem.size(), stem) != 0
+       || name.compare(name.size()-ext.size(), ext.size(), ext) != 0) return false;
+    std::size_t i = stem.size();
+    const std::size_t end = name.size()-ext.size();
+    const auto digits = [&](std::size_t n){
+      for(std::size_t k=0; k<n; ++k, ++i) if(i >= end || !std::isdigit(static_cast<unsigned char>(name[i]))) return false;
+      return true;
+    };
+    
+    //"-" and the date as rotationFormat() writes it, if there is a period.
+    if(const char* format = rotationFormat()) {
+      if(i >= end || name[i++] != '-') return false;
+      for(const char* f = format; *f; ++f) {
+	if(*f == '%') {
+	  if(!digits(*++f == 'Y' ? 4 : 2)) return false;
+	}
+	else if(i >= end || name[i++] != *f) return false;
+      }
+    }
+    //Then "-" and a sequence number, required without period.
+    if(i == end) return i > stem.size();
+    if(name[i++] != '-' || i == end || name[i] == '0') return false;
+    while(i < end) if(!digits(1)) return false;
+    return true;
+  }
+
+  std::string SQLogger::rotationName(std::time_t start, std::size_t seq) const
+  {
+    const std::size_t dot = extension(baseFile);
+    std::string name = baseFile.substr(0, dot);
+    if(const char* format = rotationFormat()) {
+      char buffer[32];
+      std::tm local;
+      localtime_r(&start, &local);
+      std::strftime(buffer, sizeof(buffer), format, &local);
+      name += '-';
+      name += buffer;
+    }
+    if(seq > 0) name += '-' + std::to_string(seq);
+    return name + baseFile.substr(dot);
+  }
+
+  void SQLogger::rotateIfDue()
+  {
+    if(!rotating || !sqlite3_get_autocommit(dbHandle)) return;
+    
+    const std::int64_t length = effective.rotatePeriod.count();
+    if(length > 0) {
+      const std::time_t now = std::time(nullptr);
+      if(now >= periodEnd) {
+	rotate(periodOf(now), 0);
+	return;
+      }
+    }
+    
+    bool full = effective.rotateRows > 0 && fileRows >= effective.rotateRows;
+    if(!full && effective.rotateSize > 0) {
+      sqlite3_stmt* stmt = statement("PRAGMA page_count");
+      if(stmt && sqlite3_step(stmt) == SQLITE_ROW) full = sqlite3_column_int64(stmt, 0)*pageSize >= effective.rotateSize;
+      if(stmt) sqlite3_reset(stmt);
+    }
+    if(full) rotate(period, sequence+1);
+  }
+
+  void SQLogger::rotate(std::time_t start, std::size_t seq)
+  {
+    const std::string name = rotationName(start, seq);
+    sqlite3* db = nullptr;
+    if(nextHandle && nextFile == name) {
+      db = nextHandle;
+      nextHandle = nullptr;
+    } else {
+      try {
+	db = open(name, effective);
+      } catch(const std::exception&) {
+	//Keeps writing into the current file; the switch is tried again at the next commit.
+	return;
+      }
+    }
+    
+    //Prepared statements belong to the former connection. Tables are created again in the new file on their next write.
+    for(auto& s : statements) sqlite3_finalize(s.second);
+    statements.clear();
+    {
+      std::lock_guard<std::mutex> lock(tablesMtx);
+      auto reset = [](TableInfo& t){
+	sqlite3_finalize(t.insert);
+	t.insert = nullptr;
+	for(auto& stmt : t.insertRows) {
+	  sqlite3_finalize(stmt);
+	  stmt = nullptr;
+	}
+	t.created = false;
+      };
+      for(auto& t : tables) reset(*t.second);
+    }
+    sqlite3_close(dbHandle);
+    
+    dbHandle = db;
+    fileName = name;
+    period = start;
+    sequence = seq;
+    fileRows = 0;
+    if(effective.rotatePeriod.count() > 0) periodEnd = periodOf(start + effective.rotatePeriod.count());
+    {
+      const char* path = sqlite3_db_filename(dbHandle, "main");
+      std::lock_guard<std::mutex> lock(readers->mtx);
+      readFile = path ? path : name;
+      ++generation;
+    }
+    
+    //A file pre-opened for a period already over is of no use anymore.
+    if(nextHandle && nextFile != rotationName(periodEnd, 0)) discardNext();
+    preopen();
+  }
+
+  void SQLogger::preopen()
+  {
+    if(nextHandle) return;
+    //Without period the next file follows the sequence. With a period, it is the one of the next period;
+    //a switch on size or rows inside the period opens its file when needed.
+    nextFile = effective.rotatePeriod.count() > 0 ? rotationName(periodEnd, 0) : rotationName(period, sequence+1);
+    nextCreated = !exists(nextFile);
+    try {
+      nextHandle = open(nextFile, effective);
+    } catch(const std::exception&) {
+      discardNext();
+    }
+  }
+
+  void SQLogger::discardNext()
+  {
+    if(nextHandle) sqlite3_close(nextHandle);
+    nextHandle = nullptr;
+    if(nextCreated) {
+      for(const char* suffix : {"", "-wal", "-shm", "-journal"}) std::remove((nextFile + suffix).c_str());
+    }
+    nextCreated = false;
+  }
+
+  void SQLogger::prune()
+  {
+    if(effective.retention.count() <= 0 || !sqlite3_get_autocommit(dbHandle)) return;
+    
+    if(pruneTables.empty()) {
+      const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      if(now < pruneNext) return;
+      pruneNext = now + effective.pruneInterval;
+      
+      //A new pass: the cutoff in both timestamp formats, then the tables of the file.
+      const std::time_t cutoff = std::time(nullptr) - static_cast<std::time_t>(effective.retention.count());
+      cutoffNanoseconds = static_cast<std::int64_t>(cutoff)*1000000000;
+      std::tm tm;
+      localtime_r(&cutoff, &tm);
+      char text[32];
+      cutoffText.assign(text, std::strftime(text, sizeof(text), "%Y-%m-%d %H-%M-%S", &tm));
+      
+      sqlite3_stmt* list = statement("SELECT name FROM sqlite_master WHERE type='table' AND name NOT LIKE 'sqlite%'");
+      while(list && sqlite3_step(list) == SQLITE_ROW) {
+	pruneTables.emplace_back(reinterpret_cast<const char*>(sqlite3_column_text(list, 0)));
+      }
+      if(list) sqlite3_reset(list);
+      if(rotating) dropExpiredFiles(cutoff);
+      if(pruneTables.empty()) return;
+    }
+    
+    //The oldest rowids of the table, as far as they are expired. Tables without MOMENT column fail to prepare and are skipped.
+    std::string table = pruneTables.back();
+    for(std::size_t quote=0; (quote = table.find('"', quote)) != std::string::npos; quote += 2) table.insert(quote, 1, '"');
+    sqlite3_stmt* stmt = statement("DELETE FROM \"" + table + "\" WHERE rowid IN (SELECT rowid FROM \"" + table + "\" ORDER BY rowid LIMIT ?1)"
+				   " AND CASE typeof(MOMENT) WHEN 'integer' THEN MOMENT < ?2 ELSE MOMENT < ?3 END");
+    bool more = false;
+    if(stmt) {
+      const std::int64_t chunk = static_cast<std::int64_t>(std::max<std::size_t>(effective.pruneChunk, 1));
+      sqlite3_bind_int64(stmt, 1, chunk);
+      sqlite3_bind_int64(stmt, 2, cutoffNanoseconds);
+      sqlite3_bind_text(stmt, 3, cutoffText.data(), cutoffText.size(), SQLITE_STATIC);
+      more = step(stmt) && sqlite3_changes(dbHandle) == chunk;
+    }
+    if(!more) pruneTables.pop_back();
+    
+    sqlite3_stmt* vacuum = statement("PRAGMA incremental_vacuum(" + std::to_string(effective.vacuumPages) + ")");
+    if(vacuum) {
+      while(sqlite3_step(vacuum) == SQLITE_ROW);
+      sqlite3_reset(vacuum);
+    }
+  }
+
+  void SQLogger::dropExpiredFiles(std::time_t cutoff)
+  {
+    const std::size_t slash = baseFile.find_last_of('/');
+    const std::string dir = slash == std::string::npos ? "." : baseFile.substr(0, std::max<std::size_t>(slash, 1));
+    const std::size_t from = slash == std::string::npos ? 0 : slash+1;
+    
+    DIR* d = opendir(dir.c_str());
+    if(!d) return;
+    std::vector<std::string> expired;
+    while(dirent* entry = readdir(d)) {
+      //Only names rotationName() may have written: other files sharing the prefix are not ours.
+      const std::string name = entry->d_name;
+      if(!isRotationName(name)) continue;
+      const std::string path = slash == std::string::npos ? name : baseFile.substr(0, from) + name;
+      if(path == fileName || (nextHandle && path == nextFile)) continue;
+      
+      //The main file of a database in WAL mode may be older than its log.
+      struct stat info;
+      if(stat(path.c_str(), &info) != 0 || info.st_mtime >= cutoff) continue;
+      if(stat((path + "-wal").c_str(), &info) == 0 && info.st_mtime >= cutoff) continue;
+      expired.push_back(path);
+    }
+    closedir(d);
+    for(const auto& path : expired) {
+      for(const char* suffix : {"", "-wal", "-shm", "-journal"}) std::remove((path + suffix).c_str());
+    }
+  }
+
+  std::int64_t SQLogger::ticks()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  void SQLogger::account(std::size_t rows, std::size_t written, std::size_t bytes, std::int64_t start)
+  {
+    writeTimes.record(ticks() - start);
+    recordCount.fetch_add(rows, std::memory_order_relaxed);
+    failedCount.fetch_add(rows - written, std::memory_order_relaxed);
+    byteCount.fetch_add(bytes, std::memory_order_relaxed);
+  }
+
+  Stats SQLogger::stats() const
+  {
+    Stats s;
+    s.records = recordCount.load(std::memory_order_relaxed);
+    s.failed = failedCount.load(std::memory_order_relaxed);
+    s.dropped = droppedCount.load(std::memory_order_relaxed);
+    s.commits = commitCount.load(std::memory_order_relaxed);
+    s.bytes = byteCount.load(std::memory_order_relaxed);
+    s.copied = copiedCount.load(std::memory_order_relaxed);
+    s.busyRetries = busyCount.load(std::memory_order_relaxed);
+    s.prepares = prepareCount.load(std::memory_order_relaxed);
+    s.prepareTime = prepareTime.load(std::memory_order_relaxed);
+    s.queueDepth = queue ? queue->size() : 0;
+    s.queueHighWater = queueHighWater.load(std::memory_order_relaxed);
+    s.log = logTimes.summary();
+    s.write = writeTimes.summary();
+    s.commit = commitTimes.summary();
+    s.endToEnd = endToEndTimes.summary();
+    s.batch = batchSizes.summary();
+    s.arena = Arena::getStats();
+    return s;
+  }
+
+  void SQLogger::reportStats()
+  {
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(effective.statsInterval.count() <= 0 || now - lastStats < effective.statsInterval) return;
+    lastStats = now;
+    
+    static const char* columns[] = {"RECORDS", "FAILED", "DROPPED", "COMMITS", "BYTES", "BUSY_RETRIES", "QUEUE_DEPTH",
+      "LOG_P50", "LOG_P99", "LOG_P999", "COMMIT_P50", "COMMIT_P99", "E2E_P50", "E2E_P99", "E2E_P999", "BATCH_MEAN"};
+    static const std::string schema = [](){
+      std::string text = "CREATE TABLE IF NOT EXISTS _sqlogger_stats(MOMENT TEXT";
+      for(const char* c : columns) text += std::string(", ") + c + " INTEGER";
+      return text + ')';
+    }();
+    static const std::string query = [](){
+      std::string text = "INSERT INTO _sqlogger_stats (MOMENT";
+      for(const char* c : columns) text += std::string(", ") + c;
+      text += ") VALUES (?";
+      for(std::size_t i=0; i<sizeof(columns)/sizeof(columns[0]); ++i) text += ", ?";
+      return text + ')';
+    }();
+    
+    const Stats s = stats();
+    const std::uint64_t figures[] = {s.records, s.failed, s.dropped, s.commits, s.bytes, s.busyRetries, s.queueDepth,
+      s.log.p50, s.log.p99, s.log.p999, s.commit.p50, s.commit.p99, s.endToEnd.p50, s.endToEnd.p99, s.endToEnd.p999,
+      static_cast<std::uint64_t>(s.batch.mean)};
+    std::vector<Value> values(1 + sizeof(figures)/sizeof(figures[0]));
+    Timestamp::now(Timestamp::Seconds, values[0]);
+    for(std::size_t i=0; i<sizeof(figures)/sizeof(figures[0]); ++i) values[i+1].setInteger(static_cast<std::int64_t>(figures[i]));
+    write(*lookup("_sqlogger_stats", schema, query), values);
+  }
+
+  bool SQLogger::drop()
+  {
+    droppedCount.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  void SQLogger::reportDrops()
+  {
+    static const char* policyNames[] = {"block", "drop newest", "drop oldest", "sample"};
+    
+    const std::size_t total = droppedCount.load(std::memory_order_relaxed);
+    if(effective.overflowReport.count() <= 0 || total == reportedDrops) return;
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if(now - lastReport < effective.overflowReport) return;
+    
+    TableInfo* t = lookup("_sqlogger_overflow", "CREATE TABLE IF NOT EXISTS _sqlogger_overflow(MOMENT TEXT, POLICY TEXT, DROPPED INTEGER, TOTAL INTEGER)",
+			  "INSERT INTO _sqlogger_overflow (MOMENT, POLICY, DROPPED, TOTAL) VALUES (?, ?, ?, ?)");
+    std::vector<Value> values(4);
+    Timestamp::now(Timestamp::Seconds, values[0]);
+    values[1].setText(policyNames[effective.overflow], std::strlen(policyNames[effective.overflow]));
+    values[2].setInteger(static_cast<std::int64_t>(total - reportedDrops));
+    values[3].setInteger(static_cast<std::int64_t>(total));
+    write(*t, values);
+    reportedDrops = total;
+    lastReport = now;
+  }
+
+  void SQLogger::wake()
+  {
+    std::lock_guard<std::mutex> lock(wakeMtx);
+    wakeUp.notify_one();
+  }
+
+  void SQLogger::recoverCrashRing()
+  {
+    std::unordered_map<std::uint32_t, TableInfo*> ids;
+    for(const CrashRing::Table& t : crashRing->tables()) ids[t.id] = lookup(t.name, t.schema, t.query);
+    const std::vector<CrashRing::Kept> kept = crashRing->pending();
+    if(!kept.empty()) {
+      std::lock_guard<std::mutex> lock(mtx);
+      begin(true);
+      for(const CrashRing::Kept& k : kept) {
+	const auto it = ids.find(k.table);
+	const Snapshot row(k.data, k.size);
+	const std::int64_t began = ticks();
+	const bool logged = it != ids.end() && write(*it->second, row);
+	account(1, logged ? 1 : 0, k.size, began);
+      }
+      //The ring is emptied next, so the records must be safe first.
+      settle();
+    }
+    
+    //The tables looked up so far are described again in the emptied ring.
+    crashRing->reset();
+    std::lock_guard<std::mutex> lock(tablesMtx);
+    for(const auto& t : tables) crashRing->describe(t.second->id, t.second->name, t.second->schema, t.second->query);
+  }
+
+  void SQLogger::tick()
+  {
+    for(;;) {
+      //Sleeps until the deadline of the open batch, or the delay if none is open.
+      std::chrono::steady_clock::duration timeout = batchDelay;
+      {
+	std::lock_guard<std::mutex> lock(mtx);
+	reportDrops();
+	reportSampling();
+	reportStats();
+	if(!sqlite3_get_autocommit(dbHandle)) {
+	  if(batchDue()) {
+	    //Retried shortly if a reader holds the database.
+	    if(!commit() && !sqlite3_get_autocommit(dbHandle)) timeout = std::chrono::milliseconds(10);
+	  }
+	  else timeout = batchStart + batchDelay - std::chrono::steady_clock::now();
+	}
+      }
+      
+      std::unique_lock<std::mutex> lock(wakeMtx);
+      if(stopping) break;
+      wakeUp.wait_for(lock, timeout);
+    }
+  }
+
+  void SQLogger::drain()
+  {
+    for(;;) {
+      const std::size_t n = queue->take(taken.data(), taken.size());
+      if(n) {
+	//Producers parked on a full queue can claim the slots just freed.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(parked.load(std::memory_order_relaxed) > 0) {
+	  std::lock_guard<std::mutex> lock(roomMtx);
+	  room.notify_all();
+	}
+	const std::size_t depth = n + queue->size();
+	if(depth > queueHighWater.load(std::memory_order_relaxed)) queueHighWater.store(depth, std::memory_order_relaxed);
+	std::lock_guard<std::mutex> lock(mtx);
+	for(std::size_t i=0; i<n; ) {
+	  //Runs of entries of the same table are written together.
+	  const Entry& e = taken[i];
+	  std::size_t j = i+1;
+	  run.clear();
+	  if(e.table) {
+	    run.push_back(&e.snapshot);
+	    while(j<n && taken[j].table == e.table) run.push_back(&taken[j++].snapshot);
+	  }
+	  
+	  if(e.more) begin(true);
+	  if(e.table) {
+	    const std::int64_t began = ticks();
+	    const std::int64_t before = fileRows;
+	    std::size_t bytes = 0;
+	    for(const Snapshot* r : run) bytes += r->size();
+	    write(*e.table, run.data(), run.size(), nullptr);
+	    account(run.size(), static_cast<std::size_t>(fileRows - before), bytes, began);
+	  }
+	  for(std::size_t k=i; k<j; ++k) {
+	    uncommitted.push_back(taken[k].block);
+	    if(taken[k].kept) uncommittedKept.push_back(taken[k].kept);
+	    copiedCount.fetch_add(taken[k].copied, std::memory_order_relaxed);
+	    if(taken[k].table) uncommittedSince.push_back(taken[k].since);
+	  }
+	  written.fetch_add(j-i, std::memory_order_relaxed);
+	  const bool groupEnd = !taken[j-1].more && batchSize <= 1;
+	  if(groupEnd || batchDue()) commit();
+	  i = j;
+	}
+	reportDrops();
+	reportSampling();
+	reportStats();
+	continue;
+      }
+      
+      //Nothing queued: close the batch if someone waits on it, otherwise sleep until its deadline at most.
+      std::chrono::steady_clock::duration timeout = std::chrono::milliseconds(100);
+      {
+	std::lock_guard<std::mutex> lock(mtx);
+	reportDrops();
+	reportSampling();
+	reportStats();
+	if(flushing.load() > 0 || stopping || batchDue()) {
+	  //Retried shortly if a reader holds the database.
+	  if(!commit() && !sqlite3_get_autocommit(dbHandle)) timeout = std::chrono::milliseconds(10);
+	}
+	else timeout = std::min(timeout, batchStart + batchDelay - std::chrono::steady_clock::now());
+      }
+      
+      std::unique_lock<std::mutex> lock(wakeMtx);
+      drained.notify_all();
+      if(stopping && !queue->ready()) break;
+      sleeping = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(!queue->ready() && !stopping && flushing.load() == 0) wakeUp.wait_for(lock, timeout);
+      sleeping = false;
+    }
+  }
+
+  std::string SQLogger::segmentName(std::uint64_t number) const
+  {
+    return baseFile + ".spill." + std::to_string(number);
+  }
+
+  void SQLogger::recoverSegments()
+  {
+    const std::size_t slash = baseFile.find_last_of('/');
+    const std::string dir = slash == std::string::npos ? "." : baseFile.substr(0, std::max<std::size_t>(slash, 1));
+    const std::size_t from = slash == std::string::npos ? 0 : slash+1;
+    const std::string prefix = baseFile.substr(from) + ".spill.";
+    
+    DIR* d = opendir(dir.c_str());
+    if(!d) return;
+    std::vector<std::uint64_t> found;
+    while(dirent* entry = readdir(d)) {
+      const std::string name = entry->d_name;
+      if(name.size() <= prefix.size() || name.compare(0, prefix.size(), prefix) != 0
+	|| name.find_first_not_of("0123456789", prefix.size()) != std::string::npos) continue;
+      found.push_back(std::stoull(name.substr(prefix.size())));
+    }
+    closedir(d);
+    
+    std::sort(found.begin(), found.end());
+    for(std::uint64_t number : found) {
+      try {
+	segments.emplace_back(new SpillSegment(segmentName(number), number));
+      } catch(const std::runtime_error&) {
+	//Left on disk for inspection, it is not a segment this version can read. Its records count as one failure.
+	failedCount.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    if(!found.empty()) segmentNumber = found.back() + 1;
+  }
+
+  bool SQLogger::spillRecord(TableInfo* table, Reader read, const void* source, bool wait)
+  {
+    //A record is the kind byte, the table id and the snapshot of its values; a table is described by its id, name,
+    //schema and query, each string prefixed by its length.
+    static thread_local std::vector<Value> values;
+    read(source, values);
+    const std::size_t size = 5 + Snapshot::measure(values);
+    const std::size_t description = 5 + 12 + table->name.size() + table->schema.size() + table->query.size();
+    if(size + description > SpillSegment::maxRecord(segmentSize)) return drop();
+    
+    SpillSegment* segment = spillCurrent.load(std::memory_order_acquire);
+    while(segment) {
+      segment->enter();
+      //Another thread may be describing the table in this segment too: a duplicate description is harmless.
+      bool described = table->spilledIn.load(std::memory_order_acquire) == segment->number();
+      if(!described) {
+	if(char* d = segment->reserve(description)) {
+	  *d = 'T';
+	  std::memcpy(d+1, &table->id, 4);
+	  d += 5;
+	  for(const std::string* s : {&table->name, &table->schema, &table->query}) {
+	    const std::uint32_t length = static_cast<std::uint32_t>(s->size());
+	    std::memcpy(d, &length, 4);
+	    std::memcpy(d+4, s->data(), length);
+	    d += 4 + length;
+	  }
+	  SpillSegment::publish(d - description);
+	  table->spilledIn.store(segment->number(), std::memory_order_release);
+	  described = true;
+	}
+      }
+      if(described) {
+	if(char* r = segment->reserve(size)) {
+	  *r = 'R';
+	  std::memcpy(r+1, &table->id, 4);
+	  Snapshot::encode(values, r+5);
+	  copiedCount.fetch_add(copiedBytes(values, true), std::memory_order_relaxed);
+	  SpillSegment::publish(r);
+	  segment->leave();
+	  return true;
+	}
+      }
+      segment->leave();
+      segment = replaceSegment(segment, wait);
+    }
+    return drop();
+  }
+
+  SpillSegment* SQLogger::replaceSegment(SpillSegment* full, bool wait)
+  {
+    std::unique_lock<std::mutex> lock(spillMtx, std::defer_lock);
+    if(wait) lock.lock();
+    else if(!lock.try_lock()) return nullptr;
+    SpillSegment* current = spillCurrent.load(std::memory_order_relaxed);
+    if(current != full) return current;
+    full->seal();
+    //Creating a segment means allocating its file, which a caller that must not wait leaves to the writer.
+    if(!spare && !wait) {
+      wake();
+      return nullptr;
+    }
+
+    std::unique_ptr<SpillSegment> next = std::move(spare);
+    if(!next) {
+      try {
+	next.reset(new SpillSegment(segmentName(segmentNumber), segmentNumber, segmentSize));
+	++segmentNumber;
+      } catch(const std::runtime_error&) {
+	//The record is dropped and counted by spillRecord().
+	return nullptr;
+      }
+    }
+    segments.push_back(std::move(next));
+    spillCurrent.store(segments.back().get(), std::memory_order_release);
+    //The writer finishes the sealed segment and creates the next spare.
+    wake();
+    return segments.back().get();
+  }
+
+  void SQLogger::ingest()
+  {
+    //Tables by id, as described in the segment being read.
+    std::unordered_map<std::uint32_t, TableInfo*> ids;
+    std::uint64_t idsOf = ~static_cast<std::uint64_t>(0);
+    std::vector<Snapshot> held;
+    for(;;) {
+      SpillSegment* segment = nullptr;
+      {
+	std::lock_guard<std::mutex> lock(spillMtx);
+	if(!spare && !stopping) {
+	  try {
+	    spare.reset(new SpillSegment(segmentName(segmentNumber), segmentNumber, segmentSize));
+	    ++segmentNumber;
+	  } catch(const std::runtime_error&) {
+	    //Tried again on the next pass; meanwhile a full segment is replaced by log() itself, or its records dropped.
+	  }
+	}
+	if(!segments.empty()) segment = segments.front().get();
+      }
+      //The current segment may have been filled by tryLog() when there was no spare.
+      SpillSegment* current = spillCurrent.load(std::memory_order_acquire);
+      if(!stopping && current->reserved() == current->capacity()) replaceSegment(current, true);
+      if(!segment) {
+	//Only once the last segment is done, or if no new one could be created.
+	if(stopping) break;
+	std::unique_lock<std::mutex> lock(wakeMtx);
+	wakeUp.wait_for(lock, batchDelay);
+	continue;
+      }
+      if(segment->number() != idsOf) {
+	ids.clear();
+	idsOf = segment->number();
+      }
+      
+      std::size_t found = 0;
+      bool end = false;
+      bool blocked = false;
+      {
+	std::lock_guard<std::mutex> lock(mtx);
+	const std::int64_t start = ticks();
+	TableInfo* table = nullptr;
+	//Runs of records of the same table are written together, straight from the mapping.
+	auto writeRun = [&](){
+	  if(held.empty()) return;
+	  begin(true);
+	  run.clear();
+	  std::size_t bytes = 0;
+	  for(const Snapshot& r : held) {
+	    run.push_back(&r);
+	    bytes += r.size();
+	  }
+	  const std::int64_t began = ticks();
+	  const std::int64_t before = fileRows;
+	  write(*table, run.data(), run.size(), nullptr);
+	  account(run.size(), static_cast<std::size_t>(fileRows - before), bytes, began);
+	  uncommittedSince.insert(uncommittedSince.end(), static_cast<std::size_t>(fileRows - before), start);
+	  held.clear();
+	};
+	
+	for(;;) {
+	  const char* data;
+	  std::size_t size;
+	  const std::size_t at = segment->position();
+	  const SpillSegment::Status status = segment->next(data, size);
+	  if(status == SpillSegment::Pending) break;
+	  if(status == SpillSegment::End) {
+	    end = segment->quiescent();
+	    break;
+	  }
+	  ++found;
+	  std::uint32_t id = 0;
+	  if(status == SpillSegment::Ready && size >= 5) std::memcpy(&id, data+1, 4);
+	  if(status == SpillSegment::Ready && size >= 17 && *data == 'T') {
+	    std::string fields[3];
+	    std::size_t pos = 5;
+	    for(std::string& field : fields) {
+	      std::uint32_t length = 0;
+	      if(pos + 4 <= size) std::memcpy(&length, data+pos, 4);
+	      if(pos + 4 + length > size) break;
+	      field.assign(data+pos+4, length);
+	      pos += 4 + length;
+	    }
+	    if(!fields[1].empty()) ids[id] = lookup(fields[0], fields[1], fields[2]);
+	    continue;
+	  }
+	  
+	  //Ingested before a crash: only the table descriptions are read again.
+	  if(at < segment->checkpointed()) continue;
+	  const auto it = ids.find(id);
+	  if(status != SpillSegment::Ready || size < 5 || *data != 'R' || it == ids.end()) {
+	    //Torn by a crash, or of a table whose description was lost with it.
+	    failedCount.fetch_add(1, std::memory_order_relaxed);
+	    continue;
+	  }
+	  if(it->second != table || held.size() == rowBlocks[0]) {
+	    writeRun();
+	    table = it->second;
+	  }
+	  held.emplace_back(data+5, size-5);
+	}
+	writeRun();
+	reportDrops();
+	reportSampling();
+	reportStats();
+	if(stopping) settle();
+	else commit();
+	if(!sqlite3_get_autocommit(dbHandle)) {
+	  //A reader holds the database: nothing is checkpointed until the open transaction is committed.
+	  end = false;
+	  found = 0;
+	  blocked = true;
+	} else {
+	  segment->checkpoint();
+	  //Past the end of a segment comes the first record of the next one.
+	  ingested.store(end ? spillPosition(segment->number()+1, 0) : spillPosition(segment->number(), segment->position()),
+			 std::memory_order_release);
+	}
+      }
+      
+      if(end) {
+	std::lock_guard<std::mutex> lock(spillMtx);
+	segment->discard();
+	spent.push_back(std::move(segments.front()));
+	segments.pop_front();
+      }
+      std::unique_lock<std::mutex> lock(wakeMtx);
+      drained.notify_all();
+      if(found || end) continue;
+      
+      //Nothing new: sleep until the next pass, unless someone waits on it.
+      sleeping = true;
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(blocked) wakeUp.wait_for(lock, std::chrono::milliseconds(10));
+      else if(!stopping && flushing.load() == 0) wakeUp.wait_for(lock, batchDelay);
+      sleeping = false;
+    }
+  }
+
+  void SQLogger::flush()
+  {
+    //Records held in a reservoir are due at once.
+    if(!samplingConfig.empty()) {
+      std::lock_guard<std::mutex> lock(mtx);
+      if(harvest(true)) settle();
+    }
+    if(spilling) {
+      std::uint64_t target;
+      {
+	std::lock_guard<std::mutex> lock(spillMtx);
+	const SpillSegment* current = spillCurrent.load();
+	target = spillPosition(current->number(), current->reserved());
+      }
+      ++flushing;
+      std::unique_lock<std::mutex> lock(wakeMtx);
+      while(ingested.load(std::memory_order_acquire) < target) {
+	wakeUp.notify_one();
+	drained.wait_for(lock, std::chrono::milliseconds(10));
+      }
+      --flushing;
+      return;
+    }
+    if(!queue) {
+      std::lock_guard<std::mutex> lock(mtx);
+      settle();
+      return;
+    }
+    
+    const std::size_t target = queue->claimed();
+    ++flushing;
+    std::unique_lock<std::mutex> lock(wakeMtx);
+    while(committed.load(std::memory_order_acquire) < target) {
+      wakeUp.notify_one();
+      drained.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    --flushing;
+  }
+
+  bool SQLogger::bind(sqlite3_stmt* stmt, const std::vector<Value>& values, int first)
+  {
+    int error=SQLITE_OK;
+    int index=first;
+    for(const auto& v : values) {
+      switch(v.getType()) {
+	case Value::Null:
+	  error = sqlite3_bind_null(stmt, index);
+	  break;
+	case Value::Integer:
+	  error = sqlite3_bind_int64(stmt, index, v.asInteger());
+	  break;
+	case Value::Real:
+	  error = sqlite3_bind_double(stmt, index, v.asReal());
+	  break;
+	case Value::Text:
+	  error = sqlite3_bind_text(stmt, index, v.data(), v.size(), SQLITE_STATIC);
+	  break;
+	case Value::Blob:
+	  error = sqlite3_bind_blob(stmt, index, v.data(), v.size(), SQLITE_STATIC);
+	  break;
+      }
+      if(error != SQLITE_OK) return false;
+      ++index;
+    }
+    return true;
+  }
+
+  bool SQLogger::bind(sqlite3_stmt* stmt, const Snapshot& snapshot, int first)
+  {
+    int error=SQLITE_OK;
+    int index=first;
+    Snapshot::Cursor v(snapshot);
+    while(v.next()) {
+      switch(v.getType()) {
+	case Value::Null:
+	  error = sqlite3_bind_null(stmt, index);
+	  break;
+	case Value::Integer:
+	  error = sqlite3_bind_int64(stmt, index, v.asInteger());
+	  break;
+	case Value::Real:
+	  error = sqlite3_bind_double(stmt, index, v.asReal());
+	  break;
+	case Value::Text:
+	  error = sqlite3_bind_text(stmt, index, v.data(), v.size(), SQLITE_STATIC);
+	  break;
+	case Value::Blob:
+	  error = sqlite3_bind_blob(stmt, index, v.data(), v.size(), SQLITE_STATIC);
+	  break;
+      }
+      if(error != SQLITE_OK) return false;
+      ++index;
+    }
+    return true;
+  }
+
+  std::size_t Snapshot::measure(const std::vector<Value>& values) noexcept
+  {
+    std::size_t size = 0;
+    for(const auto& v : values) {
+      switch(v.getType()) {
+	case Value::Null:
+	  size += 1;
+	  break;
+	case Value::Integer:
+	case Value::Real:
+	  size += 1 + sizeof(std::int64_t);
+	  break;
+	case Value::Text:
+	case Value::Blob:
+	  size += 1 + sizeof(std::uint32_t) + v.size();
+	  break;
+      }
+    }
+    return size;
+  }
+
+  Snapshot Snapshot::encode(const std::vector<Value>& values, char* buffer) noexcept
+  {
+    char* pos = buffer;
+    for(const auto& v : values) {
+      *pos++ = static_cast<char>(v.getType());
+      switch(v.getType()) {
+	case Value::Null:
+	  break;
+	case Value::Integer: {
+	  std::int64_t x = v.asInteger();
+	  std::memcpy(pos, &x, sizeof(x));
+	  pos += sizeof(x);
+	  break;
+	}
+	case Value::Real: {
+	  double x = v.asReal();
+	  std::memcpy(pos, &x, sizeof(x));
+	  pos += sizeof(x);
+	  break;
+	}
+	case Value::Text:
+	case Value::Blob: {
+	  std::uint32_t n = v.size();
+	  std::memcpy(pos, &n, sizeof(n));
+	  std::memcpy(pos+sizeof(n), v.data(), n);
+	  pos += sizeof(n) + n;
+	  break;
+	}
+      }
+    }
+    return Snapshot(buffer, pos-buffer);
+  }
+
+  bool Snapshot::Cursor::next() noexcept
+  {
+    if(pos >= end) return false;
+    type = static_cast<Value::Type>(*pos++);
+    switch(type) {
+      case Value::Null:
+	break;
+      case Value::Integer:
+	std::memcpy(&integer, pos, sizeof(integer));
+	pos += sizeof(integer);
+	break;
+      case Value::Real:
+	std::memcpy(&real, pos, sizeof(real));
+	pos += sizeof(real);
+	break;
+      case Value::Text:
+      case Value::Blob: {
+	std::uint32_t n;
+	std::memcpy(&n, pos, sizeof(n));
+	length = n;
+	bytes = pos + sizeof(n);
+	pos = bytes + n;
+	break;
+      }
+    }
+    return true;
+  }
+
   //Strong guarantee exception safe -- See addField member function.
   Record::Record()
   {
-    addField("MOMENT", "TEXT", std::bind(&Record::getTime, this));
+    setTimeFormat(Timestamp::Seconds);
   }
 
   //Strong guarantee exception safe
   void Record::addField(const std::string& fieldName, const std::string& typeDesc, std::function< const std::string(void)> callback)
+  {
+    addFetcher(fieldName, typeDesc, [callback](Value& v){ std::string s = callback(); v.setText(std::move(s)); });
+  }
+
+  void Record::addField(const std::string& fieldName, const std::string& typeDesc, std::function<std::int64_t(void)> callback)
+  {
+    addFetcher(fieldName, typeDesc, [callback](Value& v){ v.setInteger(callback()); });
+  }
+
+  void Record::addField(const std::string& fieldName, const std::string& typeDesc, std::function<double(void)> callback)
+  {
+    addFetcher(fieldName, typeDesc, [callback](Value& v){ v.setReal(callback()); });
+  }
+
+  void Record::addField(const std::string& fieldName, const std::string& typeDesc, std::function<TextRef(void)> callback)
+  {
+    addFetcher(fieldName, typeDesc, [callback](Value& v){ TextRef t = callback(); v.setTextView(t.data, t.size); });
+  }
+
+  void Record::addField(const std::string& fieldName, const std::string& typeDesc, std::function<BlobRef(void)> callback)
+  {
+    addFetcher(fieldName, typeDesc, [callback](Value& v){ BlobRef b = callback(); v.setBlobView(b.data, b.size); });
+  }
+
+#if __cplusplus >= 201703L
+  void Record::addField(const std::string& fieldName, const std::string& typeDesc, std::function<std::string_view(void)> callback)
+  {
+    addFetcher(fieldName, typeDesc, [callback](Value& v){ std::string_view t = callback(); v.setTextView(t.data(), t.size()); });
+  }
+#endif
+
+  //Strong guarantee exception safe
+  void Record::addFetcher(const std::string& fieldName, const std::string& typeDesc, std::function<void(Value&)> fetcher)
   {
     if(fieldName.empty()) throw std::invalid_argument("Record::addField -> fieldName must not be empty");
     if(typeDesc.empty()) throw std::invalid_argument("Record::addField -> typeDesc must not be empty");
-    //if(!std::is_function<decltype(callback)>::value) throw std::invalid_argument("Record::addField -> callback must be a callable object");
     
     //------------- Strong guarantee barrier ------------------
     
-    fields.emplace_back(std::make_tuple(fieldName, typeDesc, callback));
+    fields.emplace_back(std::make_tuple(fieldName, typeDesc, fetcher));
     updateSchema();
   }
 
+  void Record::setTimeFormat(Timestamp::Format format)
+  {
+    std::function<void(Value&)> fetcher = [format](Value& v){ Timestamp::now(format, v); };
+    //MOMENT is always the first field: replaced in place when already there.
+    if(fields.empty()) {
+      addFetcher("MOMENT", Timestamp::typeDesc(format), fetcher);
+    } else {
+      std::get<1>(fields.front()) = Timestamp::typeDesc(format);
+      std::get<2>(fields.front()) = fetcher;
+      updateSchema();
+    }
+  }
+
   void Record::setTableName(const std::string& tblName) noexcept
   {
     tableName = tblName;
@@ -117,40 +1909,67 @@ namespace sqlogger{
 	schema += std::get<0>(f) + ' ' + std::get<1>(f) + ',';    
       }
       schema.back()=')'; //Replacing last comma with parenthesis.
+      
+      query = "INSERT INTO " + tableName + " (";
+      for(const auto& f : fields) {
+	query += std::get<0>(f) + ',';
+      }
+      query.back()=')';
+      query += " VALUES (";
+      for(std::size_t i=0; i<fields.size(); ++i) {
+	query += "?,";
+      }
+      query.back()=')';
     } else {
       schema.clear();
+      query.clear();
+    }
+  }
+
+  void Timestamp::now(Format format, Value& value)
+  {
+    const std::int64_t ns = epochNanoseconds();
+    if(format == EpochNanoseconds) {
+      value.setInteger(ns);
+      return;
+    }
+    
+    //Per thread cache of the formatted second.
+    static thread_local std::time_t second = -1;
+    static thread_local char text[48];
+    static thread_local std::size_t prefix = 0;
+    
+    const std::time_t current = static_cast<std::time_t>(ns / 1000000000);
+    if(current != second) {
+      std::tm tm;
+      localtime_r(&current, &tm);
+      prefix = std::strftime(text, sizeof(text), "%Y-%m-%d %H-%M-%S", &tm); //ISO-8601 Format.
+      second = current;
+    }
+    
+    std::size_t length = prefix;
+    int digits = format == Milliseconds ? 3 : format == Microseconds ? 6 : 0;
+    if(digits > 0) {
+      std::int64_t fraction = (ns % 1000000000) / (format == Milliseconds ? 1000000 : 1000);
+      text[length] = '.';
+      for(int i=digits; i>0; --i, fraction /= 10) text[length+i] = '0' + fraction % 10;
+      length += digits + 1;
     }
+    value.setText(text, length);
   }
 
-  const std::string Record::getTime()
+  std::int64_t Timestamp::epochNanoseconds()
   {
-    std::stringstream helper;
-    std::time_t local = std::time(nullptr);
-    std::tm tm = *std::localtime(&local);
-    helper << std::put_time(&tm, "%Y-%m-%d %H-%M-%S"); //ISO-8601 Format.
-    return helper.str();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
   }
 
-  const std::string Record::writeQuery()
+  void Record::readValues(std::vector<Value>& values)
   {
-    std::string query;
-    if(!schema.empty()) {
-      query = "INSERT INTO " + tableName + " (";
-      
-      for(const auto& f : fields) {
-	query += std::get<0>(f) + ',';
-      }
-      
-      query.back()=')';
-      query += " VALUES (";
-      
-      for(const auto& f : fields) {
-	auto callback = std::get<2>(f);
-	query += '\'' + callback() + "\',";
-      }
-      query.back()=')';
+    values.resize(fields.size());
+    auto v = values.begin();
+    for(const auto& f : fields) {
+      std::get<2>(f)(*v++);
     }
-    return query;
   }
  
  
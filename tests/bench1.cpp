@@ -0,0 +1,74 @@
+/* \file bench1.cpp
+ * \author Carlos Nihelton <carlosnsoliveira@gmail.com> (C) 2015
+ * 
+ * Microbenchmark of the SQLogger insert path.
+ * ------------------------------------------------------------------------------------
+ * It measures the average latency of SQLogger::log, which reuses one prepared statement per table,
+ * against the former path of preparing and finalizing a freshly built INSERT for each record.
+ * This code is licensed under GNU LGPL v2.1 license.
+ * See <http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html> for more datails.
+ * 
+ */
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <sqlogger.h>
+
+class BenchRec : public sqlogger::Record
+{
+private:
+  std::string message;
+  
+public:
+  BenchRec(){
+    message = "Benchmarking the insert path";
+    setTableName("bench");
+    addField("MSG", "TEXT", std::bind(&BenchRec::msg, this));
+  };
+  const std::string msg(){return message;};
+};
+
+typedef std::chrono::steady_clock Clock;
+
+//Average microseconds per insert of the callable.
+template<typename F>
+double measure(int records, F insert)
+{
+  auto start = Clock::now();
+  for(int i=0; i<records; ++i) insert();
+  std::chrono::duration<double, std::micro> elapsed = Clock::now() - start;
+  return elapsed.count()/records;
+}
+
+int main(int argc, char *argv[])
+{
+  //An in-memory database by default, so that disk syncs do not hide the SQL parsing cost.
+  const int records = argc > 1 ? std::atoi(argv[1]) : 10000;
+  const std::string file = argc > 2 ? argv[2] : ":memory:";
+  
+  BenchRec rec;
+  auto& logger = sqlogger::SQLogger::instance(file);
+  double cached = measure(records, [&](){ logger.log(&rec); });
+  
+  //Reference: the same INSERT text, timestamp included, built, prepared and finalized for every record.
+  sqlite3* db;
+  sqlite3_open(file == ":memory:" ? file.c_str() : (file + ".reference").c_str(), &db);
+  sqlite3_exec(db, "CREATE TABLE IF NOT EXISTS bench(MOMENT TEXT,MSG TEXT)", nullptr, nullptr, nullptr);
+  double prepared = measure(records, [&](){
+    sqlite3_stmt* stmt;
+    std::stringstream moment;
+    std::time_t local = std::time(nullptr);
+    std::tm tm = *std::localtime(&local);
+    moment << std::put_time(&tm, "%Y-%m-%d %H-%M-%S");
+    std::string query = "INSERT INTO bench (MOMENT,MSG) VALUES ('" + moment.str() + "','" + rec.msg() + "')";
+    sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+  });
+  sqlite3_close(db);
+  
+  std::cout << "records:                " << records << '\n'
+            << "prepare per insert:     " << prepared << " us/insert\n"
+            << "cached statement:       " << cached << " us/insert\n";
+}
@@ -0,0 +1,65 @@
+/* \file bench2.cpp
+ * \author Carlos Nihelton <carlosnsoliveira@gmail.com> (C) 2015
+ * 
+ * Throughput benchmark of group commit.
+ * ------------------------------------------------------------------------------------
+ * It compares records per second of the autocommit path against batches of growing size,
+ * both synchronous and async. Each configuration gets its own logger.
+ * This code is licensed under GNU LGPL v2.1 license.
+ * See <http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html> for more datails.
+ * 
+ */
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <sqlogger.h>
+
+class BenchRec : public sqlogger::Record
+{
+private:
+  std::string message;
+  
+public:
+  BenchRec(){
+    message = "Benchmarking group commit";
+    setTableName("bench");
+    addField("MSG", "TEXT", std::bind(&BenchRec::msg, this));
+  };
+  const std::string msg(){return message;};
+};
+
+typedef std::chrono::steady_clock Clock;
+
+//Logs the records into a fresh database and prints the rate, flush included.
+void run(const std::string& file, int records, const sqlogger::Options& options)
+{
+  std::remove(file.c_str());
+  BenchRec rec;
+  sqlogger::SQLogger logger(file, options);
+  
+  auto start = Clock::now();
+  for(int i=0; i<records; ++i) logger.log(&rec);
+  logger.flush();
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  
+  std::cout << (options.async ? "async" : "sync ") << "  batch " << options.batchSize << ":\t"
+            << records/elapsed.count() << " records/s" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  const int records = argc > 1 ? std::atoi(argv[1]) : 2000;
+  const std::string file = argc > 2 ? argv[2] : "bench_batch.db";
+  const std::size_t batches[] = {1, 10, 100, 1000};
+  
+  for(bool async : {false, true}) {
+    for(std::size_t batch : batches) {
+      sqlogger::Options options;
+      options.async = async;
+      options.batchSize = batch;
+      run(file, records, options);
+    }
+  }
+}
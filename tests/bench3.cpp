@@ -0,0 +1,67 @@
+/* \file bench3.cpp
+ * \author Carlos Nihelton <carlosnsoliveira@gmail.com> (C) 2015
+ * 
+ * Throughput benchmark of multi-row INSERT statements.
+ * ------------------------------------------------------------------------------------
+ * It compares records per second of bulk log calls written with multi-row INSERTs against single-row stepping,
+ * for records of 3 and 20 columns, in an in-memory database so that the per-step cost is not hidden by disk syncs.
+ * This code is licensed under GNU LGPL v2.1 license.
+ * See <http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html> for more datails.
+ * 
+ */
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <sqlogger.h>
+
+class WideRec : public sqlogger::Record
+{
+private:
+  std::int64_t counter;
+  
+public:
+  //MOMENT plus columns-1 integer fields.
+  WideRec(int columns) : counter(0){
+    setTableName("wide" + std::to_string(columns));
+    for(int i=1; i<columns; ++i) {
+      addField("C" + std::to_string(i), "INTEGER", std::bind(&WideRec::count, this));
+    }
+  };
+  std::int64_t count(){return ++counter;};
+};
+
+typedef std::chrono::steady_clock Clock;
+
+void run(int columns, bool multiRow, int records, std::size_t batch)
+{
+  sqlogger::Options options;
+  options.multiRowInsert = multiRow;
+  sqlogger::SQLogger logger(":memory:", options);
+  
+  //Records are not copyable: their field callbacks are bound to this.
+  std::vector<std::unique_ptr<WideRec>> recs;
+  std::vector<sqlogger::Record*> ptrs;
+  for(std::size_t i=0; i<batch; ++i) {
+    recs.emplace_back(new WideRec(columns));
+    ptrs.push_back(recs.back().get());
+  }
+  
+  auto start = Clock::now();
+  for(int logged=0; logged<records; logged+=batch) logger.log(ptrs);
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  
+  std::cout << columns << " columns, " << (multiRow ? "multi-row: " : "single-row:") << '\t'
+            << records/elapsed.count() << " records/s" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+  const int records = argc > 1 ? std::atoi(argv[1]) : 200000;
+  const std::size_t batch = argc > 2 ? std::atoi(argv[2]) : 1000;
+  
+  for(int columns : {3, 20}) {
+    run(columns, false, records, batch);
+    run(columns, true, records, batch);
+  }
+}
@@ -0,0 +1,135 @@
+/* \file bench4.cpp
+ * \author Carlos Nihelton <carlosnsoliveira@gmail.com> (C) 2015
+ *
+ * Benchmark suite of the logging hot path, built as the sqlogger_bench target with BUILD_BENCHMARKS.
+ * ------------------------------------------------------------------------------------
+ * It measures records per second and the p50/p99/p999 latency of log() for every combination
+ * of thread count, record width, payload size and durability setting, and prints them as JSON
+ * so that results can be compared from one release to the next.
+ * Each thread logs the same number of records, so every configuration has enough samples for its
+ * percentiles; a percentile still lacking them, e.g. p999 of less than 1000 records, is printed as null.
+ * Usage: sqlogger_bench [records per thread] [database file] [max threads]
+ * This code is licensed under GNU LGPL v2.1 license.
+ * See <http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html> for more datails.
+ *
+ */
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <sqlogger.h>
+
+class BenchRec : public sqlogger::Record
+{
+private:
+  std::string payload;
+  std::int64_t counter;
+
+public:
+  //MOMENT, a text payload and columns-2 integer fields.
+  BenchRec(int columns, std::size_t bytes) : payload(bytes, 'x'), counter(0){
+    setTableName("bench" + std::to_string(columns));
+    addField("PAYLOAD", "TEXT", std::bind(&BenchRec::text, this));
+    for(int i=2; i<columns; ++i) {
+      addField("C" + std::to_string(i), "INTEGER", std::bind(&BenchRec::count, this));
+    }
+  };
+  sqlogger::TextRef text(){return sqlogger::TextRef{payload.data(), payload.size()};};
+  std::int64_t count(){return ++counter;};
+};
+
+//A durability setting: how far a logged record is from being safe on disk.
+struct Durability {
+  const char* name;
+  const char* journalMode;
+  sqlogger::Options::Synchronous synchronous;
+  bool async;
+  std::size_t batchSize;
+};
+
+//Latencies in nanoseconds, -1 when there are too few samples for the percentile.
+struct Result {
+  double recordsPerSecond;
+  std::int64_t p50, p99, p999;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+//Logs perThread records from each thread into a fresh database, timing each log() call.
+Result run(const std::string& file, int perThread, int threads, int columns, std::size_t bytes, const Durability& d)
+{
+  for(const char* suffix : {"", "-wal", "-shm", "-journal"}) std::remove((file + suffix).c_str());
+  sqlogger::Options options;
+  options.journalMode = d.journalMode;
+  options.synchronous = d.synchronous;
+  options.async = d.async;
+  options.batchSize = d.batchSize;
+  sqlogger::SQLogger logger(file, options);
+
+  std::vector<std::vector<std::int64_t>> latencies(threads);
+  auto start = Clock::now();
+  std::vector<std::thread> pool;
+  for(int t=0; t<threads; ++t) pool.emplace_back([&, t](){
+    BenchRec rec(columns, bytes);
+    std::vector<std::int64_t>& mine = latencies[t];
+    mine.reserve(perThread);
+    for(int i=0; i<perThread; ++i) {
+      auto before = Clock::now();
+      logger.log(&rec);
+      mine.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count());
+    }
+  });
+  for(auto& t : pool) t.join();
+  logger.flush();
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+
+  std::vector<std::int64_t> all;
+  all.reserve(perThread*threads);
+  for(const auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+  std::sort(all.begin(), all.end());
+  auto percentile = [&all](double p){
+    if(all.empty() || (1 - p)*all.size() < 1) return static_cast<std::int64_t>(-1);
+    return all[std::min(all.size()-1, static_cast<std::size_t>(p*all.size()))];
+  };
+  return Result{all.size()/elapsed.count(), percentile(0.50), percentile(0.99), percentile(0.999)};
+}
+
+int main(int argc, char *argv[])
+{
+  const int perThread = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 2000;
+  const std::string file = argc > 2 ? argv[2] : "bench_suite.db";
+  const int maxThreads = argc > 3 ? std::atoi(argv[3]) : 64;
+
+  const int widths[] = {3, 20};
+  const std::size_t payloads[] = {16, 1024};
+  const Durability durabilities[] = {
+    {"full", "DELETE", sqlogger::Options::SyncFull, false, 1},
+    {"wal-normal", "WAL", sqlogger::Options::SyncNormal, false, 100},
+    {"wal-async", "WAL", sqlogger::Options::SyncNormal, true, 100},
+    {"off-async", "MEMORY", sqlogger::Options::SyncOff, true, 1000},
+  };
+
+  std::cout << "{\n  \"records_per_thread\": " << perThread << ",\n  \"results\": [";
+  auto latency = [](std::int64_t ns){ return ns < 0 ? std::string("null") : std::to_string(ns); };
+  const char* separator = "\n";
+  for(const auto& d : durabilities) {
+    for(int width : widths) {
+      for(std::size_t bytes : payloads) {
+	for(int threads=1; threads<=maxThreads; threads *= 2) {
+	  Result r = run(file, perThread, threads, width, bytes, d);
+	  std::cout << separator << "    {\"durability\": \"" << d.name << "\", \"threads\": " << threads
+		    << ", \"columns\": " << width << ", \"payload\": " << bytes
+		    << ", \"records_per_s\": " << static_cast<std::int64_t>(r.recordsPerSecond)
+		    << ", \"p50_ns\": " << latency(r.p50) << ", \"p99_ns\": " << latency(r.p99)
+		    << ", \"p999_ns\": " << latency(r.p999) << "}";
+	  separator = ",\n";
+	}
+      }
+    }
+  }
+  std::cout << "\n  ]\n}" << std::endl;
+}
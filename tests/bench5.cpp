@@ -0,0 +1,70 @@
+/* \file bench5.cpp
+ * \author Carlos Nihelton <carlosnsoliveira@gmail.com> (C) 2015
+ *
+ * Bytes copied per record, with fields returning strings or views.
+ * ------------------------------------------------------------------------------------
+ * A std::string field is copied out of the record by its getter; a TextRef field is only viewed,
+ * bound in place in synchronous mode and copied once, into the snapshot, in async mode.
+ * It prints, as JSON, the records per second and the copied bytes per record reported by SQLogger::stats().
+ * Usage: bench5 [records per configuration] [database file]
+ * This code is licensed under GNU LGPL v2.1 license.
+ * See <http://www.gnu.org/licenses/old-licenses/lgpl-2.1.html> for more datails.
+ *
+ */
+
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <cstdio>
+#include <sqlogger.h>
+
+class CopyRec : public sqlogger::Record
+{
+private:
+  std::string payload;
+  
+public:
+  CopyRec(std::size_t bytes, bool view) : payload(bytes, 'x'){
+    setTableName(view ? "viewed" : "copied");
+    if(view) addField("PAYLOAD", "TEXT", std::bind(&CopyRec::ref, this));
+    else addField("PAYLOAD", "TEXT", std::bind(&CopyRec::text, this));
+  };
+  const std::string text(){return payload;};
+  sqlogger::TextRef ref(){return sqlogger::TextRef{payload.data(), payload.size()};};
+};
+
+int main(int argc, char *argv[])
+{
+  const int records = argc > 1 ? std::atoi(argv[1]) : 100000;
+  const std::string file = argc > 2 ? argv[2] : "bench_copies.db";
+  
+  const std::size_t payloads[] = {16, 256, 4096};
+  std::cout << "{\n  \"records\": " << records << ",\n  \"results\": [";
+  const char* separator = "\n";
+  for(bool async : {false, true}) {
+    for(bool view : {false, true}) {
+      for(std::size_t bytes : payloads) {
+	for(const char* suffix : {"", "-wal", "-shm", "-journal"}) std::remove((file + suffix).c_str());
+	sqlogger::Options options;
+	options.journalMode = "WAL";
+	options.synchronous = sqlogger::Options::SyncNormal;
+	options.batchSize = 1000;
+	options.async = async;
+	sqlogger::SQLogger logger(file, options);
+	CopyRec rec(bytes, view);
+	
+	auto start = std::chrono::steady_clock::now();
+	for(int i=0; i<records; ++i) logger.log(&rec);
+	logger.flush();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	const sqlogger::Stats s = logger.stats();
+	std::cout << separator << "    {\"mode\": \"" << (async ? "async" : "sync") << "\", \"field\": \""
+		  << (view ? "TextRef" : "std::string") << "\", \"payload\": " << bytes
+		  << ", \"records_per_s\": " << static_cast<std::int64_t>(records/elapsed.count())
+		  << ", \"copied_bytes_per_record\": " << (s.records ? s.copied/s.records : 0) << "}";
+	separator = ",\n";
+      }
+    }
+  }
+  std::cout << "\n  ]\n}" << std::endl;
+}
@@ -11,9 +11,19 @@
 
 #include <iostream>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
 #include <thread>
+#include <algorithm>
+#include <map>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <utime.h>
 #include <gtest/gtest.h>
 #include <sqlogger.h>
+#include <staticrecord.h>
+#include <shardedlogger.h>
 
 class Teste1 : public sqlogger::Record
 {
@@ -38,6 +48,58 @@ Teste1::Teste1(){
     addField("MSG", "TEXT", std::bind(&Teste1::msg, this));
 }
 
+//A second record type, logged into its own table through the same logger.
+class Teste2 : public sqlogger::Record
+{
+private:
+  std::int64_t counter;
+  
+public:
+  Teste2() : counter(0){
+    setTableName("counters");
+    setTimeFormat(sqlogger::Timestamp::EpochNanoseconds);
+    addField("COUNTER", "INTEGER", std::bind(&Teste2::count, this));
+  };
+  std::int64_t count(){return ++counter;};
+};
+
+//A record viewing its text in place, or copying it out like Teste1 when byValue is set.
+class Viewed : public sqlogger::Record
+{
+private:
+  std::string payload;
+  
+public:
+  Viewed(std::size_t bytes, bool byValue) : payload(bytes, 'v'){
+    setTableName(byValue ? "copied" : "viewed");
+    if(byValue) addField("PAYLOAD", "TEXT", std::bind(&Viewed::copy, this));
+    else addField("PAYLOAD", "TEXT", std::bind(&Viewed::view, this));
+  };
+  sqlogger::TextRef view(){return sqlogger::TextRef{payload.data(), payload.size()};};
+  const std::string copy(){return payload;};
+};
+
+//Removes a database file along with its journal, WAL and shared memory files.
+void removeDb(const std::string& file)
+{
+  for(const char* suffix : {"", "-journal", "-wal", "-shm"}) std::remove((file + suffix).c_str());
+}
+
+//Runs a query on its own read-only connection and returns the first column of its first row, -1 if none.
+std::int64_t rows(const std::string& file, const std::string& sql)
+{
+  sqlite3* db;
+  std::int64_t result = -1;
+  if(sqlite3_open_v2(file.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) == SQLITE_OK) {
+    sqlite3_stmt* stmt = nullptr;
+    if(sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+      result = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+  }
+  sqlite3_close(db);
+  return result;
+}
+
 TEST(SQLogger, creation)
 {
   Teste1 var;
@@ -46,6 +108,722 @@ TEST(SQLogger, creation)
 }
 
 
+TEST(SQLogger, tables)
+{
+  Teste1 first;
+  Teste2 second;
+  first.setMsg("Hello, again!");
+  ASSERT_TRUE(sqlogger::SQLogger::instance().log(&first));
+  ASSERT_TRUE(sqlogger::SQLogger::instance().log(&second));
+  ASSERT_TRUE(sqlogger::SQLogger::instance().log(&second));
+}
+
+TEST(SQLogger, options)
+{
+  const sqlogger::Options& defaults = sqlogger::SQLogger::instance().getOptions();
+  ASSERT_FALSE(defaults.journalMode.empty());
+  ASSERT_NE(defaults.synchronous, sqlogger::Options::SyncDefault);
+  
+  removeDb("options.db");
+  sqlogger::Options options;
+  options.journalMode = "WAL";
+  options.synchronous = sqlogger::Options::SyncNormal;
+  options.cacheSize = -4096;
+  options.mmapSize = 1 << 20;
+  options.tempStore = sqlogger::Options::TempMemory;
+  options.walAutocheckpoint = 500;
+  sqlogger::SQLogger logger("options.db", options);
+  const sqlogger::Options& effective = logger.getOptions();
+  EXPECT_EQ(effective.journalMode, "wal");
+  EXPECT_EQ(effective.synchronous, sqlogger::Options::SyncNormal);
+  EXPECT_EQ(effective.cacheSize, -4096);
+  EXPECT_EQ(effective.mmapSize, 1 << 20);
+  EXPECT_EQ(effective.tempStore, sqlogger::Options::TempMemory);
+  EXPECT_EQ(effective.walAutocheckpoint, 500);
+  
+  //SQLite refuses WAL for an in-memory database, and the logger reports what it kept instead.
+  sqlogger::SQLogger memory(":memory:", options);
+  EXPECT_EQ(memory.getOptions().journalMode, "memory");
+}
+
+TEST(SQLogger, quotes)
+{
+  Teste1 var;
+  const std::string message = "It's bound, not pasted: '); DROP TABLE hello; --\n\"quoted\"";
+  var.setMsg(message);
+  ASSERT_TRUE(sqlogger::SQLogger::instance().log(&var));
+  
+  sqlogger::SQLogger logger(":memory:");
+  ASSERT_TRUE(logger.log(&var));
+  std::vector<std::string> stored;
+  logger.query("SELECT MSG FROM hello", [&stored](const std::vector<sqlogger::Value>& row){
+    stored.emplace_back(row[0].data(), row[0].size());
+  });
+  ASSERT_EQ(stored.size(), 1u);
+  EXPECT_EQ(stored[0], message);
+}
+
+//Same table and columns as Teste1, described at compile time.
+SQLOGGER_NAME(hello);
+SQLOGGER_NAME(USER);
+SQLOGGER_NAME(MSG);
+typedef sqlogger::StaticRecord<hello, sqlogger::Field<USER, sqlogger::Text>, sqlogger::Field<MSG, sqlogger::Text>> StaticHello;
+
+TEST(SQLogger, staticRecord)
+{
+  StaticHello var(std::getenv("USER"), "");
+  var.get<MSG>() = "Hello from a StaticRecord";
+  ASSERT_EQ(StaticHello::writeQuery(), "INSERT INTO hello (MOMENT,USER,MSG) VALUES (?,?,?)");
+  ASSERT_TRUE(sqlogger::SQLogger::instance().log(var));
+}
+
+TEST(SQLogger, instances)
+{
+  sqlogger::Options options;
+  options.async = true;
+  options.batchSize = 100;
+  sqlogger::SQLogger telemetry("telemetry.db", options);
+  sqlogger::SQLogger audit("audit.db");
+  
+  Teste1 var;
+  var.setMsg("Hello, telemetry!");
+  for(int i=0; i<1000; ++i) ASSERT_TRUE(telemetry.log(&var));
+  var.setMsg("Hello, audit!");
+  ASSERT_TRUE(audit.log(&var));
+  telemetry.flush();
+}
+
+//A record missing its table name, which cannot be logged.
+class NoTable : public sqlogger::Record {};
+
+TEST(SQLogger, bulk)
+{
+  std::vector<Teste1> batch(100);
+  std::vector<sqlogger::Record*> recs;
+  for(auto& r : batch) {
+    r.setMsg("Hello, batch!");
+    recs.push_back(&r);
+  }
+  NoTable invalid;
+  recs.push_back(&invalid);
+  
+  std::vector<bool> logged = sqlogger::SQLogger::instance().log(recs);
+  ASSERT_EQ(logged.size(), 101u);
+  EXPECT_EQ(std::count(logged.begin(), logged.end(), true), 100);
+  EXPECT_FALSE(logged.back());
+  
+  sqlogger::Options options;
+  options.async = true;
+  sqlogger::SQLogger async("bulk.db", options);
+  logged = async.log(recs.begin(), recs.begin()+50);
+  EXPECT_EQ(std::count(logged.begin(), logged.end(), true), 50);
+  async.flush();
+}
+
+TEST(SQLogger, shards)
+{
+  //Rows left by a previous run would be counted again.
+  for(const char* f : {"sharded.0.db", "sharded.1.db", "sharded.2.db", "sharded.3.db", "merged.db"}) removeDb(f);
+  sqlogger::ShardedLogger logger("sharded.db", 4);
+  ASSERT_EQ(logger.shardFile(2), "sharded.2.db");
+  
+  auto f = [&logger](){
+    Teste1 var;
+    var.setMsg("Hello, shard!");
+    for(int i=0; i<25; ++i) ASSERT_TRUE(logger.log(&var));
+  };
+  std::vector<std::thread> thread_pool;
+  for (int i=0; i<8; i++) thread_pool.emplace_back(std::thread{f});
+  for(auto &t : thread_pool) t.join();
+  
+  Teste2 keyed;
+  for(std::size_t key=0; key<4; ++key) ASSERT_TRUE(logger.log(&keyed, key));
+  logger.merge("merged.db");
+  
+  sqlite3* db;
+  sqlite3_open(":memory:", &db);
+  logger.attach(db);
+  sqlite3_stmt* stmt;
+  sqlite3_prepare_v2(db, "SELECT (SELECT count(*) FROM hello), (SELECT count(*) FROM counters)", -1, &stmt, nullptr);
+  ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+  EXPECT_EQ(sqlite3_column_int(stmt, 0), 200);
+  EXPECT_EQ(sqlite3_column_int(stmt, 1), 4);
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+}
+
+TEST(SQLogger, snapshot)
+{
+  std::vector<sqlogger::Value> values(4);
+  values[0].setInteger(-42);
+  values[1].setReal(0.5);
+  values[2].setText("It's a snapshot");
+  values[3].setBlob("\0\1", 2);
+  std::vector<char> buffer(sqlogger::Snapshot::measure(values));
+  sqlogger::Snapshot snapshot = sqlogger::Snapshot::encode(values, buffer.data());
+  ASSERT_EQ(snapshot.size(), buffer.size());
+  
+  sqlogger::Snapshot::Cursor c(snapshot);
+  ASSERT_TRUE(c.next());
+  EXPECT_EQ(c.asInteger(), -42);
+  ASSERT_TRUE(c.next());
+  EXPECT_EQ(c.asReal(), 0.5);
+  ASSERT_TRUE(c.next());
+  EXPECT_EQ(std::string(c.data(), c.size()), "It's a snapshot");
+  ASSERT_TRUE(c.next());
+  EXPECT_EQ(c.getType(), sqlogger::Value::Blob);
+  EXPECT_EQ(c.size(), 2u);
+  EXPECT_FALSE(c.next());
+  
+  //Records on the stack of short lived threads: the queue only holds their snapshots.
+  sqlogger::Options options;
+  options.async = true;
+  sqlogger::SQLogger logger("snapshot.db", options);
+  std::vector<std::thread> thread_pool;
+  for (int i=0; i<8; i++) thread_pool.emplace_back(std::thread{[&logger](){
+    Teste1 var;
+    var.setMsg("Logged and gone");
+    ASSERT_TRUE(logger.log(&var));
+  }});
+  for(auto &t : thread_pool) t.join();
+  logger.flush();
+}
+
+TEST(SQLogger, arena)
+{
+  sqlogger::Arena::Block small = sqlogger::Arena::allocate(100);
+  sqlogger::Arena::Block large = sqlogger::Arena::allocate(sqlogger::Arena::slabSize);
+  EXPECT_NE(small.slab, nullptr);
+  EXPECT_EQ(large.slab, nullptr);
+  sqlogger::Arena::Stats stats = sqlogger::Arena::getStats();
+  EXPECT_GE(stats.inUse, sqlogger::Arena::slabSize);
+  EXPECT_GE(stats.highWater, stats.inUse);
+  EXPECT_GE(stats.fallbacks, 1u);
+  sqlogger::Arena::Block blocks[] = {small, large};
+  sqlogger::Arena::release(blocks, 2);
+  
+  //Enough records to go through several slabs; they all come back once committed.
+  sqlogger::Options options;
+  options.async = true;
+  options.batchSize = 100;
+  sqlogger::SQLogger logger("arena.db", options);
+  Teste1 var;
+  var.setMsg(std::string(1000, 'a'));
+  for(int i=0; i<1000; i++) ASSERT_TRUE(logger.log(&var));
+  logger.flush();
+  EXPECT_LE(sqlogger::Arena::getStats().inUse, 2*sqlogger::Arena::slabSize);
+}
+
+TEST(SQLogger, overflow)
+{
+  removeDb("overflow.db");
+  sqlogger::Options options;
+  options.async = true;
+  options.queueCapacity = 2;
+  options.overflow = sqlogger::Options::OverflowDropOldest;
+  options.overflowReport = std::chrono::milliseconds(1);
+  std::size_t dropped = 0;
+  {
+    sqlogger::SQLogger logger("overflow.db", options);
+    Teste1 var;
+    var.setMsg("Maybe evicted");
+    for(int i=0; i<2000; i++) ASSERT_TRUE(logger.log(&var));
+    for(int i=0; i<2000; i++) logger.tryLog(&var);
+    logger.flush();
+    dropped = logger.dropped();
+    //Lets the report period elapse, so that the writer reports the drops before leaving.
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  
+  //Whatever the timing, each record is either in the table or counted as dropped.
+  EXPECT_EQ(static_cast<std::size_t>(rows("overflow.db", "SELECT count(*) FROM hello")) + dropped, 4000u);
+  if(dropped > 0) {
+    EXPECT_EQ(static_cast<std::size_t>(rows("overflow.db", "SELECT max(TOTAL) FROM _sqlogger_overflow")), dropped);
+  }
+
+  //Blocked producers wait for the writer to free slots, none is dropped.
+  removeDb("blocked.db");
+  options.overflow = sqlogger::Options::OverflowBlock;
+  {
+    sqlogger::SQLogger logger("blocked.db", options);
+    std::vector<std::thread> producers;
+    for(int t=0; t<8; t++) producers.emplace_back([&logger](){
+      Teste1 var;
+      var.setMsg("Waited");
+      for(int i=0; i<250; i++) ASSERT_TRUE(logger.log(&var));
+    });
+    for(auto& t : producers) t.join();
+    logger.flush();
+    EXPECT_EQ(logger.dropped(), 0u);
+  }
+  EXPECT_EQ(rows("blocked.db", "SELECT count(*) FROM hello"), 2000);
+}
+
+TEST(SQLogger, query)
+{
+  removeDb("query.db");
+  sqlogger::Options options;
+  options.journalMode = "WAL";
+  options.async = true;
+  sqlogger::SQLogger logger("query.db", options);
+  Teste1 var;
+  var.setMsg("Read me");
+  for(int i=0; i<10; i++) ASSERT_TRUE(logger.log(&var));
+  logger.flush();
+  
+  auto reader = [&logger](){
+    std::vector<sqlogger::Value> params(1);
+    params[0].setText("Read me");
+    std::int64_t count = 0;
+    EXPECT_EQ(logger.query("SELECT count(*) FROM hello WHERE MSG = ?", params,
+			   [&count](const std::vector<sqlogger::Value>& row){ count = row[0].asInteger(); }), 1u);
+    EXPECT_EQ(count, 10);
+    EXPECT_THROW(logger.query("DELETE FROM hello", [](const std::vector<sqlogger::Value>&){}), std::runtime_error);
+  };
+  std::thread t(reader);
+  reader();
+  t.join();
+  
+  //Each thread's connection is closed when it exits; evicted statements are prepared again when needed.
+  auto descriptors = [](){
+    std::size_t n = 0;
+    DIR* d = opendir("/proc/self/fd");
+    while(d && readdir(d)) ++n;
+    if(d) closedir(d);
+    return n;
+  };
+  const std::size_t before = descriptors();
+  for(int i=0; i<20; i++) std::thread(reader).join();
+  EXPECT_EQ(descriptors(), before);
+  for(int round=0; round<2; round++) {
+    for(int i=0; i<100; i++) {
+      std::int64_t value = -1;
+      logger.query("SELECT " + std::to_string(i), [&value](const std::vector<sqlogger::Value>& row){ value = row[0].asInteger(); });
+      EXPECT_EQ(value, i);
+    }
+  }
+  
+  sqlogger::SQLogger memory(":memory:");
+  ASSERT_TRUE(memory.log(&var));
+  EXPECT_EQ(memory.query("SELECT MSG FROM hello", [](const std::vector<sqlogger::Value>& row){
+    EXPECT_EQ(std::string(row[0].data(), row[0].size()), "Read me");
+  }), 1u);
+  EXPECT_THROW(memory.query("DELETE FROM hello", [](const std::vector<sqlogger::Value>&){}), std::runtime_error);
+  EXPECT_EQ(memory.query("SELECT count(*) FROM hello", [](const std::vector<sqlogger::Value>& row){
+    EXPECT_EQ(row[0].asInteger(), 1);
+  }), 1u);
+  
+  //The first query switches a database in another journal mode to WAL, its open batch committed first.
+  removeDb("switched.db");
+  options.journalMode = "DELETE";
+  options.async = false;
+  options.batchSize = 100;
+  sqlogger::SQLogger switched("switched.db", options);
+  ASSERT_TRUE(switched.log(&var));
+  EXPECT_EQ(switched.query("SELECT MSG FROM hello", [](const std::vector<sqlogger::Value>&){}), 1u);
+  EXPECT_EQ(switched.getOptions().journalMode, "wal");
+}
+
+TEST(SQLogger, rotation)
+{
+  for(const char* f : {"rotated.db", "rotated-1.db", "rotated-2.db", "rotated-3.db"}) removeDb(f);
+  sqlogger::Options options;
+  options.rotateRows = 100;
+  {
+    sqlogger::SQLogger logger("rotated.db", options);
+    Teste1 var;
+    var.setMsg("Rotate me");
+    for(int i=0; i<250; i++) ASSERT_TRUE(logger.log(&var));
+    EXPECT_EQ(logger.getFileName(), "rotated-2.db");
+  }
+  
+  //Each record is in exactly one file; the pre-opened rotated-3.db was removed.
+  std::size_t expected[] = {100, 100, 50};
+  const char* files[] = {"rotated.db", "rotated-1.db", "rotated-2.db"};
+  for(int i=0; i<3; i++) EXPECT_EQ(static_cast<std::size_t>(rows(files[i], "SELECT count(*) FROM hello")), expected[i]);
+  EXPECT_EQ(std::fopen("rotated-3.db", "rb"), nullptr);
+  
+  options.rotateRows = 0;
+  options.rotatePeriod = std::chrono::hours(1);
+  sqlogger::SQLogger hourly("hourly.db", options);
+  std::string name = hourly.getFileName();
+  ASSERT_EQ(name.size(), std::string("hourly-2026-10-18T14.db").size());
+  EXPECT_EQ(name.compare(0, 7, "hourly-"), 0);
+  EXPECT_EQ(name[17], 'T');
+  
+  //Switching to WAL for query() opens the next file again, in the new mode.
+  for(const char* f : {"walrot.db", "walrot-1.db"}) removeDb(f);
+  options.rotatePeriod = std::chrono::seconds(0);
+  options.rotateRows = 10;
+  sqlogger::SQLogger walRotated("walrot.db", options);
+  walRotated.query("SELECT 1", [](const std::vector<sqlogger::Value>&){});
+  sqlite3* db;
+  ASSERT_EQ(sqlite3_open_v2("walrot-1.db", &db, SQLITE_OPEN_READONLY, nullptr), SQLITE_OK);
+  sqlite3_stmt* stmt;
+  sqlite3_prepare_v2(db, "PRAGMA journal_mode", -1, &stmt, nullptr);
+  ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+  EXPECT_STREQ(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)), "wal");
+  sqlite3_finalize(stmt);
+  sqlite3_close(db);
+}
+
+TEST(SQLogger, retention)
+{
+  removeDb("retention.db");
+  sqlogger::Options options;
+  options.retention = std::chrono::hours(24);
+  options.pruneChunk = 1000;
+  options.pruneInterval = std::chrono::milliseconds(0);
+  Teste1 var;
+  var.setMsg("Kept");
+  {
+    sqlogger::SQLogger logger("retention.db", options);
+    ASSERT_TRUE(logger.log(&var));
+  }
+  
+  sqlite3* db;
+  sqlite3_open("retention.db", &db);
+  sqlite3_exec(db, "WITH RECURSIVE n(i) AS (SELECT 1 UNION ALL SELECT i+1 FROM n WHERE i<2500) "
+	       "INSERT INTO hello SELECT '2000-01-01 00-00-00', 'nobody', 'Expired' FROM n", nullptr, nullptr, nullptr);
+  sqlite3_close(db);
+  EXPECT_EQ(rows("retention.db", "PRAGMA auto_vacuum"), 2);
+  EXPECT_EQ(rows("retention.db", "SELECT count(*) FROM hello"), 2501);
+  
+  //One chunk per commit: three of them clear the 2500 expired rows.
+  {
+    sqlogger::SQLogger logger("retention.db", options);
+    for(int i=0; i<5; i++) ASSERT_TRUE(logger.log(&var));
+  }
+  EXPECT_EQ(rows("retention.db", "SELECT count(*) FROM hello WHERE MSG = 'Expired'"), 0);
+  EXPECT_EQ(rows("retention.db", "SELECT count(*) FROM hello"), 6);
+  
+  //Old rotated files go; neighbours that merely share the prefix stay.
+  const char* old[] = {"pruned-5.db", "pruned-customer-backup.db", "pruned-2000-01-01.db", "pruned-05.db"};
+  for(const char* f : {"pruned.db", "pruned-1.db"}) removeDb(f);
+  for(const char* f : old) {
+    std::fclose(std::fopen(f, "wb"));
+    struct utimbuf times = {946684800, 946684800};
+    utime(f, &times);
+  }
+  options.rotateRows = 100;
+  {
+    sqlogger::SQLogger logger("pruned.db", options);
+    ASSERT_TRUE(logger.log(&var));
+  }
+  for(const char* f : old) {
+    std::FILE* file = std::fopen(f, "rb");
+    EXPECT_EQ(file == nullptr, f == old[0]) << f;
+    if(file) std::fclose(file);
+    removeDb(f);
+  }
+}
+
+TEST(SQLogger, stats)
+{
+  sqlogger::Histogram h(4);
+  for(std::uint64_t v=1; v<=1000; ++v) h.record(v);
+  sqlogger::Histogram::Summary summary = h.summary();
+  EXPECT_EQ(summary.count, 1000u);
+  EXPECT_DOUBLE_EQ(summary.mean, 500.5);
+  EXPECT_NEAR(summary.p50, 500, 500/8);
+  EXPECT_NEAR(summary.p99, 990, 990/8);
+  EXPECT_NEAR(summary.max, 1000, 1000/8);
+  
+  sqlogger::Options options;
+  options.async = true;
+  options.batchSize = 10;
+  sqlogger::SQLogger logger(":memory:", options);
+  Teste1 var;
+  var.setMsg("Counted");
+  for(int i=0; i<100; i++) ASSERT_TRUE(logger.log(&var));
+  logger.flush();
+  sqlogger::Stats stats = logger.stats();
+  EXPECT_EQ(stats.records, 100u);
+  EXPECT_EQ(stats.failed, 0u);
+  EXPECT_EQ(stats.log.count, 100u);
+  EXPECT_EQ(stats.endToEnd.count, 100u);
+  EXPECT_GE(stats.commits, 1u);
+  EXPECT_GT(stats.bytes, 100u*std::strlen("Counted"));
+  EXPECT_GE(stats.prepares, 2u);
+  EXPECT_EQ(stats.queueDepth, 0u);
+}
+
+TEST(SQLogger, spill)
+{
+  removeDb("spill.db");
+  sqlogger::Options options;
+  options.spill = true;
+  options.spillSegmentSize = 4096;
+  auto count = [](){return rows("spill.db", "SELECT count(*) FROM hello");};
+  {
+    sqlogger::SQLogger logger("spill.db", options);
+    auto f = [&logger](){
+      Teste1 var;
+      var.setMsg("Spilled");
+      for(int i=0; i<150; i++) ASSERT_TRUE(logger.log(&var));
+    };
+    std::thread t(f);
+    f();
+    t.join();
+    logger.flush();
+    EXPECT_EQ(count(), 300);
+    EXPECT_EQ(logger.stats().records, 300u);
+  }
+  //Every segment was ingested and removed.
+  EXPECT_EQ(std::fopen("spill.db.spill.0", "rb"), nullptr);
+  
+  //A crashed process leaves its segments behind; the next one ingests what was not committed yet.
+  options.batchDelay = std::chrono::hours(1);
+  pid_t child = fork();
+  if(child == 0) {
+    sqlogger::SQLogger logger("spill.db", options);
+    Teste1 var;
+    var.setMsg("Crashed");
+    for(int i=0; i<100; i++) logger.log(&var);
+    _exit(0);
+  }
+  int status;
+  waitpid(child, &status, 0);
+  options.batchDelay = std::chrono::milliseconds(10);
+  {
+    sqlogger::SQLogger logger("spill.db", options);
+    logger.flush();
+    EXPECT_EQ(count(), 400);
+  }
+  
+  //A file that is not a segment is left alone and counted as a failure. tryLog() never creates a segment itself:
+  //without a spare, the record is dropped.
+  std::FILE* junk = std::fopen("spill.db.spill.99", "wb");
+  std::fputs("Not a segment", junk);
+  std::fclose(junk);
+  {
+    sqlogger::SQLogger logger("spill.db", options);
+    EXPECT_EQ(logger.stats().failed, 1u);
+    Teste1 var;
+    var.setMsg("Tried");
+    for(int i=0; i<1000; i++) logger.tryLog(&var);
+    logger.flush();
+    EXPECT_EQ(static_cast<std::size_t>(count() - 400) + logger.dropped(), 1000u);
+  }
+  EXPECT_EQ(std::remove("spill.db.spill.99"), 0);
+}
+
+TEST(SQLogger, failedConstruction)
+{
+  for(const char* f : {"unbuilt.db", "unbuilt-1.db"}) removeDb(f);
+  auto descriptors = [](){
+    std::size_t n = 0;
+    DIR* d = opendir("/proc/self/fd");
+    while(d && readdir(d)) ++n;
+    if(d) closedir(d);
+    return n;
+  };
+  const std::size_t before = descriptors();
+  sqlogger::Options options;
+  options.rotateRows = 10;
+  options.crashRing = "/nonexistent/dir/x.ring";
+  EXPECT_THROW(sqlogger::SQLogger("unbuilt.db", options), std::runtime_error);
+  //Neither the connection nor the pre-opened next file outlive the failure.
+  EXPECT_EQ(descriptors(), before);
+  EXPECT_EQ(std::fopen("unbuilt-1.db", "rb"), nullptr);
+  removeDb("unbuilt.db");
+}
+
+TEST(SQLogger, crashRing)
+{
+  removeDb("crash.db");
+  std::remove("crash.ring");
+  sqlogger::Options options;
+  options.async = true;
+  options.batchSize = 1000;
+  options.batchDelay = std::chrono::hours(1);
+  options.crashRing = "crash.ring";
+  auto count = [](){return rows("crash.db", "SELECT count(*) FROM hello");};
+  
+  //The records of a process dying with an open batch are only in the ring.
+  pid_t child = fork();
+  if(child == 0) {
+    sqlogger::SQLogger logger("crash.db", options);
+    Teste1 var;
+    var.setMsg("Post-mortem");
+    for(int i=0; i<50; i++) logger.log(&var);
+    _exit(0);
+  }
+  int status;
+  waitpid(child, &status, 0);
+  {
+    sqlogger::SQLogger logger("crash.db", options);
+    EXPECT_EQ(count(), 50);
+    EXPECT_EQ(logger.stats().records, 50u);
+    Teste1 var;
+    var.setMsg("Committed");
+    for(int i=0; i<10; i++) ASSERT_TRUE(logger.log(&var));
+  }
+  EXPECT_EQ(count(), 60);
+  
+  //After a clean shutdown nothing is recovered twice.
+  sqlogger::SQLogger logger("crash.db", options);
+  EXPECT_EQ(count(), 60);
+}
+
+TEST(SQLogger, views)
+{
+  //MOMENT is formatted into each record, a few bytes copied whatever the fields.
+  const std::size_t bytes = 1000, records = 10, moment = 64;
+  Viewed viewed(bytes, false), copied(bytes, true);
+  sqlogger::SQLogger logger(":memory:");
+  for(std::size_t i=0; i<records; i++) ASSERT_TRUE(logger.log(&viewed));
+  EXPECT_LT(logger.stats().copied, records*moment);
+  for(std::size_t i=0; i<records; i++) ASSERT_TRUE(logger.log(&copied));
+  EXPECT_GE(logger.stats().copied, records*bytes);
+  EXPECT_EQ(logger.query("SELECT PAYLOAD FROM viewed", [&](const std::vector<sqlogger::Value>& row){
+    EXPECT_EQ(std::string(row[0].data(), row[0].size()), std::string(bytes, 'v'));
+  }), records);
+  
+  //In async mode the only copy is the snapshot.
+  sqlogger::Options options;
+  options.async = true;
+  sqlogger::SQLogger async(":memory:", options);
+  for(std::size_t i=0; i<records; i++) ASSERT_TRUE(async.log(&viewed));
+  async.flush();
+  EXPECT_GE(async.stats().copied, records*bytes);
+  EXPECT_LT(async.stats().copied, records*(bytes + 2*moment));
+}
+
+TEST(SQLogger, sampling)
+{
+  removeDb("sampling.db");
+  sqlogger::Options options;
+  options.sampling["hello"].mode = sqlogger::Sampling::SampleRatio;
+  options.sampling["hello"].ratio = 0.1;
+  options.sampling["counters"].mode = sqlogger::Sampling::SampleReservoir;
+  options.sampling["counters"].reservoir = 5;
+  options.sampling["counters"].window = std::chrono::hours(1);
+  options.sampling["viewed"].mode = sqlogger::Sampling::SampleRate;
+  options.sampling["viewed"].rate = 0.001;
+  options.sampling["viewed"].burst = 10;
+  options.samplingReport = std::chrono::milliseconds(0);
+  options.batchSize = 1000;
+  const int records = 1000;
+  Teste1 ratio;
+  Teste2 reservoir;
+  Viewed rate(10, false);
+  {
+    sqlogger::SQLogger logger("sampling.db", options);
+    for(int i=0; i<records; i++) {
+      ASSERT_TRUE(logger.log(&ratio));
+      ASSERT_TRUE(logger.log(&reservoir));
+      ASSERT_TRUE(logger.log(&rate));
+    }
+    //Field callbacks only ran for the records chosen by the reservoir.
+    EXPECT_LT(reservoir.count(), 100);
+  }
+  
+  sqlogger::SQLogger reader("sampling.db");
+  std::map<std::string, std::int64_t> stored;
+  for(const char* table : {"hello", "counters", "viewed"}) {
+    reader.query(std::string("SELECT count(*) FROM ") + table, [&](const std::vector<sqlogger::Value>& row){ stored[table] = row[0].asInteger(); });
+  }
+  EXPECT_GT(stored["hello"], 30);
+  EXPECT_LT(stored["hello"], 300);
+  EXPECT_EQ(stored["counters"], 5);
+  EXPECT_EQ(stored["viewed"], 10);
+  EXPECT_EQ(reader.query("SELECT TABLE_NAME, SUM(SEEN), SUM(KEPT) FROM _sqlogger_sampling GROUP BY TABLE_NAME",
+			 [&](const std::vector<sqlogger::Value>& row){
+    EXPECT_EQ(row[1].asInteger(), records);
+    EXPECT_EQ(row[2].asInteger(), stored[std::string(row[0].data(), row[0].size())]);
+  }), 3u);
+  
+  //The writer harvests a reservoir when its window ends, while other tables keep logging; flush() does not wait for it.
+  removeDb("harvest.db");
+  sqlogger::Options async;
+  async.async = true;
+  async.sampling["counters"].mode = sqlogger::Sampling::SampleReservoir;
+  async.sampling["counters"].reservoir = 5;
+  async.sampling["counters"].window = std::chrono::milliseconds(50);
+  async.sampling["hello"].mode = sqlogger::Sampling::SampleReservoir;
+  async.sampling["hello"].window = std::chrono::hours(1);
+  sqlogger::SQLogger logger("harvest.db", async);
+  for(int i=0; i<10; i++) ASSERT_TRUE(logger.log(&reservoir));
+  for(int i=0; i<100; i++) {
+    ASSERT_TRUE(logger.log(&ratio));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  EXPECT_EQ(rows("harvest.db", "SELECT count(*) FROM counters"), 5);
+  EXPECT_EQ(rows("harvest.db", "SELECT count(*) FROM hello"), -1);
+  logger.flush();
+  EXPECT_EQ(rows("harvest.db", "SELECT count(*) FROM hello"), 100);
+}
+
+TEST(SQLogger, batchDeadline)
+{
+  removeDb("deadline.db");
+  sqlogger::Options options;
+  options.batchSize = 100;
+  options.batchDelay = std::chrono::milliseconds(50);
+  sqlogger::SQLogger logger("deadline.db", options);
+  Teste1 var;
+  var.setMsg("On time");
+  for(int i=0; i<5; i++) ASSERT_TRUE(logger.log(&var));
+  
+  //Nothing else is logged: the batch is committed by its deadline all the same.
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  EXPECT_EQ(rows("deadline.db", "SELECT count(*) FROM hello"), 5);
+}
+
+TEST(SQLogger, busyCommit)
+{
+  removeDb("busy.db");
+  sqlogger::Options options;
+  options.batchSize = 10;
+  options.busyTimeout = std::chrono::milliseconds(50);
+  sqlogger::SQLogger logger("busy.db", options);
+  Teste1 var;
+  var.setMsg("Held back");
+  ASSERT_TRUE(logger.log(&var));
+  logger.flush();
+  
+  //A reader stopped in the middle of a SELECT holds a SHARED lock: the writer cannot COMMIT meanwhile.
+  sqlite3* db;
+  ASSERT_EQ(sqlite3_open_v2("busy.db", &db, SQLITE_OPEN_READONLY, nullptr), SQLITE_OK);
+  sqlite3_stmt* stmt;
+  sqlite3_prepare_v2(db, "SELECT MSG FROM hello", -1, &stmt, nullptr);
+  ASSERT_EQ(sqlite3_step(stmt), SQLITE_ROW);
+  for(int i=0; i<10; i++) ASSERT_TRUE(logger.log(&var));
+  EXPECT_EQ(logger.stats().failed, 0u);
+  sqlite3_finalize(stmt);
+  
+  //The batch was kept open and is committed once the reader is gone.
+  sqlite3_close(db);
+  logger.flush();
+  EXPECT_EQ(rows("busy.db", "SELECT count(*) FROM hello"), 11);
+  EXPECT_EQ(logger.stats().failed, 0u);
+}
+
+//Fewer columns than Teste1, in the same table.
+class Terse : public sqlogger::Record
+{
+public:
+  Terse(){
+    setTableName("hello");
+    addField("MSG", "TEXT", std::bind(&Terse::msg, this));
+  }
+  const std::string msg(){return "Terse";};
+};
+
+TEST(SQLogger, variants)
+{
+  removeDb("variants.db");
+  sqlogger::SQLogger logger("variants.db");
+  Teste1 full;
+  Terse terse;
+  //Each INSERT is prepared once, however the two kinds of records alternate.
+  for(int i=0; i<2000; i++) ASSERT_TRUE(i % 2 ? logger.log(&terse) : logger.log(&full));
+  EXPECT_LT(logger.stats().prepares, 10u);
+  std::int64_t terseRows = 0;
+  logger.query("SELECT count(*) FROM hello WHERE USER IS NULL", [&](const std::vector<sqlogger::Value>& row){ terseRows = row[0].asInteger(); });
+  EXPECT_EQ(terseRows, 1000);
+}
 
 TEST(SQLogger, thread)
 {